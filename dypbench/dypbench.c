@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <x68k/iocs.h>
+#include <x68k/dos.h>
+
+#include "dyptether.h"
+#include "daynaport.h"
+
+//****************************************************************************
+// Definition
+//****************************************************************************
+
+#define DYPB_ETHERTYPE      0x88b5      // IEEE 802 Local Experimental EtherType 1
+#define DYPB_MAGIC          0x44595042  // "DYPB"
+
+// 計測フレームの種類
+#define DYPB_STREAM         1   // スループット計測 (反射すると DYPB_STREAM_ECHO になる)
+#define DYPB_STREAM_ECHO    2
+#define DYPB_REQUEST        3   // 往復時間計測 (反射すると DYPB_RESPONSE になる)
+#define DYPB_RESPONSE       4
+
+#define ETH_HLEN            14
+#define ETH_ZLEN            60
+#define ETH_FRAME_MAX       1514
+
+#define MAX_COUNT           4096    // 1つのフレーム長で送信するフレーム数の上限
+#define MAX_SIZES           8
+#define TICKS_PER_SEC       20000   // dp_timestamp() の単位 (50us)
+#define WAIT_TIMEOUT        TICKS_PER_SEC   // 送信できない時や応答を待つ時間
+#define N_REFLECT           8       // 反射待ちのフレームを溜めておく数
+
+// 計測フレーム
+struct dypb_frame {
+  uint8_t dst[6];
+  uint8_t src[6];
+  uint16_t type;
+  uint32_t magic;
+  uint16_t kind;
+  uint16_t reserved;
+  uint32_t seq;
+  uint32_t stamp;           // 送信した時刻 (50us単位)
+  uint8_t data[ETH_FRAME_MAX - ETH_HLEN - 16];
+} __attribute__((packed, aligned(2)))
+#ifndef __m68k__
+  __attribute__((scalar_storage_order("big-endian")))   // ホストのシミュレータ上でも実機と同じバイト順にする
+#endif
+  ;
+
+#define DYPB_HLEN           (ETH_HLEN + 16)
+
+//****************************************************************************
+// Static variables
+//****************************************************************************
+
+static int unit = 0;                      // 使用するネットワークインターフェース (en0/en1)
+static int count = 1000;                  // 1つのフレーム長で送信するフレーム数
+static int nsizes = 0;
+static int sizes[MAX_SIZES];              // 計測するフレーム長
+static bool flag_reflect = false;         // 反射側として動作する
+static bool flag_loopback = false;        // ドライバを使わず、プログラム内で反射する
+static uint8_t peer[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static uint8_t mymac[6];
+
+static void *drventry;                    // ドライバの呼び出し口 (superjsr entry)
+static int (*ether_call)(int cmd, void *args);
+
+static struct dypb_frame txframe;
+static uint32_t rtt[MAX_COUNT];
+
+// 受信ハンドラと共有する変数
+static volatile uint32_t echo_frames;
+static volatile uint32_t echo_bytes;
+static volatile uint32_t echo_last;       // 最後に反射フレームを受信した時刻
+static volatile uint32_t resp_seq;        // 最後に受信した応答のシーケンス番号
+static volatile uint32_t resp_stamp;      // 最後に受信した応答の受信時刻
+static volatile bool resp_valid;
+
+// 反射待ちのフレーム (受信ハンドラで溜め、メインループで送信する)
+static struct {
+  int len;
+  struct dypb_frame f;
+} reflect_buf[N_REFLECT];
+static volatile int reflect_head;
+static volatile int reflect_tail;
+static uint32_t reflect_dropped;
+
+//****************************************************************************
+// Driver interface
+//****************************************************************************
+
+#ifdef __m68k__
+// Human68k のデバイスドライバのリンクから /dev/enN を探し、呼び出し口を返す
+static void *find_ether(int unit)
+{
+  char *p = (char *)0x006800;
+  while (memcmp(p, "NUL     ", 8) != 0) {
+    p += 2;
+  }
+
+  struct dos_dev_header *devh = (struct dos_dev_header *)(p - 14);
+  while (devh != (struct dos_dev_header *)-1) {
+    char *name = devh->name;
+    if (memcmp(name, "/dev/en", 7) == 0 && name[7] == '0' + unit &&
+        memcmp(name + 8, "EthD", 4) == 0) {
+      return (char *)devh + 0x1e;
+    }
+    devh = devh->next;
+  }
+  return NULL;
+}
+
+// ドライバの superjsr entry を呼び出す (スーパーバイザモードで呼ぶ)
+static int driver_call(int cmd, void *args)
+{
+  register int d0 __asm__("d0") = cmd;
+  register void *a0 __asm__("a0") = args;
+  register void *a1 __asm__("a1") = drventry;
+  __asm__ volatile ("jsr %%a1@" : "+r"(d0), "+r"(a0) : "r"(a1) : "memory", "cc");
+  return d0;
+}
+#else
+// ホストのシミュレータ上では、同じプログラムに組み込んだドライバ (dyptether/host/benchhost.c) を呼び出す
+void *host_find_ether(int unit);
+int host_ether_call(int unit, int cmd, void *args);
+
+static void *find_ether(int unit)
+{
+  return host_find_ether(unit);
+}
+
+static int driver_call(int cmd, void *args)
+{
+  return host_ether_call(unit, cmd, args);
+}
+#endif
+
+static void recv_handler(int len, uint8_t *buf, uint32_t flag);
+
+// ドライバを使わずにプログラム内で反射するループバック (-l)
+// 計測処理そのものをネットワークやドライバなしで確認するための反射スタブ
+// (実機と比べる数値はホストのシミュレータ版 dyptether/host/dypbench で計測する)
+static int loopback_call(int cmd, void *args)
+{
+  static struct dypb_frame loopframe;
+
+  switch (cmd) {
+  case 1:
+    memcpy(args, "\x02\x00\x00\x00\x00\x01", 6);
+    return 0;                           // 呼び出し側は負の値 (エラー) かどうかしか見ない
+  case 4:
+  {
+    struct {
+      int size;
+      uint8_t *buf;
+    } *sendpkt = args;
+    struct dypb_frame *f = &loopframe;
+    memcpy(f, sendpkt->buf, sendpkt->size);
+    memcpy(f->dst, f->src, 6);
+    memcpy(f->src, "\x02\x00\x00\x00\x00\x02", 6);
+    f->kind = (f->kind == DYPB_REQUEST) ? DYPB_RESPONSE : DYPB_STREAM_ECHO;
+    recv_handler(sendpkt->size, (uint8_t *)f, 0);
+    return 0;
+  }
+  case 5:
+  case 7:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+static int send_frame(struct dypb_frame *f, int len)
+{
+  struct {
+    int size;
+    uint8_t *buf;
+  } sendpkt = { len, (uint8_t *)f };
+  return ether_call(4, &sendpkt);
+}
+
+//****************************************************************************
+// Receive handler
+//****************************************************************************
+
+// ドライバから割り込みまたはスレッドの中で呼ばれる
+static void recv_handler(int len, uint8_t *buf, uint32_t flag)
+{
+  struct dypb_frame *f = (struct dypb_frame *)buf;
+
+  if (len < DYPB_HLEN || f->magic != DYPB_MAGIC) {
+    return;
+  }
+
+  switch (f->kind) {
+  case DYPB_STREAM_ECHO:
+    echo_frames++;
+    echo_bytes += len;
+    echo_last = dp_timestamp();
+    break;
+  case DYPB_RESPONSE:
+    resp_stamp = dp_timestamp();
+    resp_seq = f->seq;
+    resp_valid = true;
+    break;
+  case DYPB_STREAM:
+  case DYPB_REQUEST:
+    if (flag_reflect) {
+      int next = (reflect_tail + 1) % N_REFLECT;
+      if (next == reflect_head || len > sizeof(struct dypb_frame)) {
+        reflect_dropped++;
+        break;
+      }
+      reflect_buf[reflect_tail].len = len;
+      memcpy(&reflect_buf[reflect_tail].f, f, len);
+      reflect_tail = next;
+    }
+    break;
+  }
+}
+
+//****************************************************************************
+// Benchmark
+//****************************************************************************
+
+static uint32_t elapsed(uint32_t start, uint32_t end)
+{
+  uint32_t t = dp_elapsed(start, end);
+  return t ? t : 1;
+}
+
+static uint32_t per_sec(uint32_t n, uint32_t ticks)
+{
+  return (uint64_t)n * TICKS_PER_SEC / ticks;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void build_frame(int kind, uint32_t seq)
+{
+  memcpy(txframe.dst, peer, 6);
+  memcpy(txframe.src, mymac, 6);
+  txframe.type = DYPB_ETHERTYPE;
+  txframe.magic = DYPB_MAGIC;
+  txframe.kind = kind;
+  txframe.seq = seq;
+  txframe.stamp = dp_timestamp();
+}
+
+static bool key_abort(void)
+{
+  if (_iocs_b_keysns() == 0) {
+    return false;
+  }
+  _iocs_b_keyinp();
+  return true;
+}
+
+// 送信キューが空くまで送信を再試行する
+static bool send_retry(int len)
+{
+  uint32_t start = dp_timestamp();
+  while (send_frame(&txframe, len) < 0) {
+    if (dp_elapsed(start, dp_timestamp()) >= WAIT_TIMEOUT) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 計測フレームを続けて送信し、送信と反射のスループットを計測する
+static bool bench_stream(int size)
+{
+  uint32_t sent = 0;
+
+  echo_frames = echo_bytes = 0;
+  uint32_t t0 = dp_timestamp();
+  for (uint32_t i = 0; i < count; i++) {
+    build_frame(DYPB_STREAM, i);
+    if (!send_retry(size)) {
+      break;
+    }
+    sent++;
+  }
+  uint32_t t1 = dp_timestamp();
+
+  // 反射フレームが揃うか、途切れてから WAIT_TIMEOUT 経つまで待つ
+  uint32_t last = echo_frames;
+  uint32_t idle = dp_timestamp();
+  while (echo_frames < sent) {
+    if (echo_frames != last) {
+      last = echo_frames;
+      idle = dp_timestamp();
+    } else if (dp_elapsed(idle, dp_timestamp()) >= WAIT_TIMEOUT) {
+      break;
+    }
+    if (key_abort()) {
+      return false;
+    }
+  }
+
+  uint32_t tx = elapsed(t0, t1);
+  uint32_t rx = elapsed(t0, echo_frames ? echo_last : t1);
+  printf("%5d  stream  tx %6" PRIu32 " frames/s %8" PRIu32 " bytes/s   echo %6" PRIu32 " frames/s %8" PRIu32
+         " bytes/s  lost %" PRIu32 "\n",
+         size,
+         per_sec(sent, tx), per_sec(sent * size, tx),
+         per_sec(echo_frames, rx), per_sec(echo_bytes, rx),
+         sent - echo_frames);
+  return true;
+}
+
+// 要求と応答を1つずつ往復させ、往復時間の分布を計測する
+static bool bench_rtt(int size)
+{
+  int n = 0;
+  uint32_t lost = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    resp_valid = false;
+    build_frame(DYPB_REQUEST, i);
+    uint32_t t0 = txframe.stamp;
+    if (!send_retry(size)) {
+      lost++;
+      continue;
+    }
+    while (!(resp_valid && resp_seq == i)) {
+      if (dp_elapsed(t0, dp_timestamp()) >= WAIT_TIMEOUT) {
+        break;
+      }
+    }
+    if (resp_valid && resp_seq == i) {
+      rtt[n++] = dp_elapsed(t0, resp_stamp);
+    } else {
+      lost++;
+    }
+    if (key_abort()) {
+      return false;
+    }
+  }
+
+  if (n == 0) {
+    printf("%5d  rtt     応答がありません\n", size);
+    return true;
+  }
+  qsort(rtt, n, sizeof(rtt[0]), cmp_u32);
+  printf("%5d  rtt     p50 %6" PRIu32 " us  p90 %6" PRIu32 " us  p99 %6" PRIu32 " us  max %6" PRIu32
+         " us  lost %" PRIu32 "\n",
+         size,
+         rtt[(n - 1) * 50 / 100] * 50, rtt[(n - 1) * 90 / 100] * 50,
+         rtt[(n - 1) * 99 / 100] * 50, rtt[n - 1] * 50, lost);
+  return true;
+}
+
+// 受信した計測フレームを送信元に送り返す (-r)
+static void reflector(void)
+{
+  uint32_t reflected = 0;
+
+  printf("反射しています (何かキーを押すと終了します)\n");
+  while (!key_abort()) {
+    while (reflect_head != reflect_tail) {
+      struct dypb_frame *f = &reflect_buf[reflect_head].f;
+      int len = reflect_buf[reflect_head].len;
+      memcpy(f->dst, f->src, 6);
+      memcpy(f->src, mymac, 6);
+      f->kind = (f->kind == DYPB_REQUEST) ? DYPB_RESPONSE : DYPB_STREAM_ECHO;
+      if (send_frame(f, len) >= 0) {
+        reflected++;
+      }
+      reflect_head = (reflect_head + 1) % N_REFLECT;
+    }
+  }
+  printf("反射したフレーム数: %" PRIu32 " (取りこぼし %" PRIu32 ")\n", reflected, reflect_dropped);
+}
+
+//****************************************************************************
+// Program entry
+//****************************************************************************
+
+static int parse_mac(const char *p, uint8_t *mac)
+{
+  for (int i = 0; i < 6; i++) {
+    char *endp;
+    unsigned long v = strtoul(p, &endp, 16);
+    if (endp == p || v > 0xff || (i < 5 && *endp != ':')) {
+      return -1;
+    }
+    mac[i] = v;
+    p = endp + 1;
+  }
+  return 0;
+}
+
+static int parse_cmdline(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++) {
+    char *p = argv[i];
+    if (*p != '/' && *p != '-') {
+      return -1;
+    }
+    p++;
+    switch (tolower(*p++)) {
+    case 'u':
+      if (*p < '0' || *p > '1') {
+        return -1;
+      }
+      unit = *p - '0';
+      break;
+    case 'n':
+      count = atoi(p);
+      if (count < 1 || count > MAX_COUNT) {
+        return -1;
+      }
+      break;
+    case 's':
+      while (*p != '\0') {
+        int size = strtol(p, &p, 10);
+        if (size < DYPB_HLEN || size > ETH_FRAME_MAX || nsizes >= MAX_SIZES) {
+          return -1;
+        }
+        if (size < ETH_ZLEN) {
+          size = ETH_ZLEN;
+        }
+        sizes[nsizes++] = size;
+        if (*p == ',') {
+          p++;
+        }
+      }
+      break;
+    case 'd':
+      if (parse_mac(p, peer) < 0) {
+        return -1;
+      }
+      break;
+    case 'r':
+      flag_reflect = true;
+      break;
+    case 'l':
+      flag_loopback = true;
+      break;
+    default:
+      return -1;
+    }
+  }
+  if (nsizes == 0) {
+    sizes[nsizes++] = ETH_ZLEN;
+    sizes[nsizes++] = 512;
+    sizes[nsizes++] = ETH_FRAME_MAX;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("X68000 DaynaPORT benchmark version " GIT_REPO_VERSION "\n");
+
+  if (parse_cmdline(argc, argv) < 0) {
+    printf(
+      "Usage: dypbench [Options]\n"
+      "Options:\n"
+      "  -u<unit>\t使用するネットワークインターフェースを指定する(0:en0(default),1:en1)\n"
+      "  -d<mac>\t反射側の MAC アドレスを xx:xx:xx:xx:xx:xx で指定する(default:ブロードキャスト)\n"
+      "  -s<size>,...\t計測するフレーム長を指定する(60~1514)(default:60,512,1514)\n"
+      "  -n<count>\tフレーム長ごとに送信するフレーム数を指定する(1~4096)(default:1000)\n"
+      "  -r\t\t反射側として動作する\n"
+      "  -l\t\tドライバを使わずプログラム内で反射する (計測処理の確認用)\n"
+    );
+    return 1;
+  }
+
+  _iocs_b_super(0);
+
+  if (flag_loopback) {
+    ether_call = loopback_call;
+  } else {
+    drventry = find_ether(unit);
+    if (drventry == NULL) {
+      printf("/dev/en%d が見つかりません\n", unit);
+      return 1;
+    }
+    ether_call = driver_call;
+  }
+
+  if (ether_call(1, mymac) < 0) {
+    printf("MAC アドレスを取得できません\n");
+    return 1;
+  }
+
+  struct {
+    int proto;
+    void (*handler)(int, uint8_t *, uint32_t);
+  } setint = { DYPB_ETHERTYPE, recv_handler };
+  if (ether_call(5, &setint) < 0) {
+    printf("受信ハンドラを登録できません\n");
+    return 1;
+  }
+  // 受信ハンドラを登録している間は CTRL+C で中断されないようにする
+  int oldbreak = _dos_breakck(-1);
+  _dos_breakck(2);
+
+  printf("en%d %02x:%02x:%02x:%02x:%02x:%02x -> %02x:%02x:%02x:%02x:%02x:%02x%s\n",
+         unit, mymac[0], mymac[1], mymac[2], mymac[3], mymac[4], mymac[5],
+         peer[0], peer[1], peer[2], peer[3], peer[4], peer[5],
+         flag_loopback ? " (loopback)" : "");
+
+  if (flag_reflect) {
+    reflector();
+  } else {
+    for (int i = 0; i < nsizes; i++) {
+      if (!bench_stream(sizes[i]) || !bench_rtt(sizes[i])) {
+        printf("中断しました\n");
+        break;
+      }
+    }
+  }
+
+  ether_call(7, (void *)DYPB_ETHERTYPE);
+  _dos_breakck(oldbreak);
+  return 0;
+}
@@ -25,154 +25,354 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
-#include <x68k/iocs.h>
 
 #include "daynaport.h"
 
-int32_t _iocs_s_dataini(int, void *);
-__asm__(
-".global _iocs_s_dataini\n"
-".type _iocs_s_dataini,@function\n"
-"_iocs_s_dataini:\n"
-"	move.l	%d3, %sp@-\n"
-"	movem.l	%sp@(8),%d3/%a1\n"
-"	moveq	#11, %d1\n"
-"	moveq	#0xfffffff5, %d0\n"
-"	trap	#15\n"
-"	move.l	%sp@+, %d3\n"
-"	rts\n"
-);
-
-uint32_t ontime(void)
+/* タイムスタンプの差分を求める */
+/* 割り込み禁止中は dp_ontime が進まないので 10ms 未満の差分として扱う */
+uint32_t dp_elapsed(uint32_t start, uint32_t end)
 {
-    struct iocs_time t;
-    t = _iocs_ontime();
-    return t.day * (24*60*60*100) + t.sec;
+    int32_t d = end - start;
+    if (d < 0) d += 200;
+    return d;
 }
 
-void wait_ms(uint32_t wait)
+static void wait_ms(uint32_t wait)
 {
     uint32_t start;
     uint32_t now;
-    uint32_t wait_10ms = wait / 10;
 
-    start = ontime();
+    start = dp_ontime();
     for (;;)
     {
-        now = ontime();
+        now = dp_ontime();
         if ((now - start) >= wait) break;
     }
 }
 
-static int32_t cmdout(int32_t size, int32_t target, uint8_t *cmd)
+#ifdef DP_FAULT_INJECT
+struct dp_fault_config dp_fault;
+static uint32_t fault_state = 1;
+
+void dp_fault_setup(const struct dp_fault_config *config)
+{
+    dp_fault = *config;
+    memset(dp_fault.injected, 0, sizeof(dp_fault.injected));
+    fault_state = config->seed ? config->seed : 1;
+}
+
+/* xorshift32 で決定的に故障を発生させる */
+static bool fault_hit(int kind)
+{
+    if (dp_fault.rate[kind] == 0) return false;
+
+    fault_state ^= fault_state << 13;
+    fault_state ^= fault_state >> 17;
+    fault_state ^= fault_state << 5;
+    if ((fault_state & 0xffff) >= dp_fault.rate[kind]) return false;
+
+    dp_fault.injected[kind]++;
+    return true;
+}
+#define FAULT(kind)     fault_hit(kind)
+#else
+#define FAULT(kind)     false
+#endif
+
+struct dp_counters dp_counters;
+
+static dp_status_t fail(dp_status_t status)
+{
+    dp_counters.errors++;
+    return status;
+}
+
+/* CDB は呼び出し元のものを書き換えないように、LUN を埋めたコピーを送る */
+static dp_status_t cmdout(int32_t size, int32_t target, const uint8_t *cmd)
 {
     int32_t status;
+    uint8_t cdb[DP_CDB_MAX];
+
+    dp_counters.commands++;
+    if (FAULT(DP_FAULT_SELECT)) return fail(DP_ERR_SELECT);
 
     for (int32_t i = 0; i < 2; i++)
     {
-        status = _iocs_s_select(target);
+        status = dp_transport->select(target);
         if (status == 0) break;
     }
-    if (status != 0) return -1;
+    if (status != 0) return fail(DP_ERR_SELECT);
 
-    cmd[1] |= (target >> 16) << 5;
-    status = _iocs_s_cmdout(size, cmd);
+    memcpy(cdb, cmd, size);
+    cdb[1] |= (target >> 16) << 5;
+    status = dp_transport->cmdout(size, cdb);
+    if (status != 0) return fail(DP_ERR_COMMAND);
 
-    return status;
+    return DP_OK;
+}
+
+static dp_status_t datain(int32_t size, void *buffer)
+{
+    if (dp_transport->datain(size, buffer) == -1) return fail(DP_ERR_DATA);
+    return DP_OK;
 }
 
-static int32_t stsmsgin(void)
+static dp_status_t datain_pio(int32_t size, void *buffer)
+{
+    if (dp_transport->datain_pio(size, buffer) == -1) return fail(DP_ERR_DATA);
+    return DP_OK;
+}
+
+static dp_status_t stsmsgin(void)
 {
     int32_t status;
     uint8_t sts;
     uint8_t msg;
 
-    status = _iocs_s_stsin(&sts);
-    if (status != 0) return -1;
+    status = dp_transport->stsin(&sts);
+    if (status != 0) return fail(DP_ERR_STSMSG);
+
+    status = dp_transport->msgin(&msg);
+    if (status != 0) return fail(DP_ERR_STSMSG);
 
-    status = _iocs_s_msgin(&msg);
-    if (status != 0) return -1;
+    if (sts != 0 || msg != 0) return fail(DP_ERR_CHECK);
+    if (FAULT(DP_FAULT_STATUS)) return fail(DP_ERR_CHECK);
 
-    return (msg << 16) | sts;
+    return DP_OK;
 }
 
 
-int32_t dp_inquiry(int32_t target, struct dp_inquiry_data *data)
+/* デバイスの走査では応答しない ID が普通にあるので、失敗をエラーに数えない */
+dp_status_t dp_inquiry(int32_t target, struct dp_inquiry_data *data)
 {
-    return _iocs_s_inquiry(sizeof(*data), target, (struct iocs_inquiry *)data);
+    int32_t status;
+
+    status = dp_transport->inquiry(sizeof(*data), target, data);
+    if (status != 0) return DP_ERR_CHECK;
+
+    return DP_OK;
 }
 
-int32_t dp_stat(int32_t size, int32_t target, void *buffer)
+dp_status_t dp_stat(int32_t size, int32_t target, void *buffer)
 {
-    int32_t status;
+    dp_status_t status;
     uint8_t cmd[6] = {0x09, 0x00, 0x00, 0x00, 0x00, 0x00};
     cmd[4] = size;
     cmd[3] = size >> 8;
 
     status = cmdout(sizeof(cmd), target, cmd);
-    if (status != 0) return -1;
+    if (status != DP_OK) return status;
 
-    status = _iocs_s_dataini(size, buffer);
-    if (status == -1) return -1;
+    status = datain_pio(size, buffer);
+    if (status != DP_OK) return status;
 
-    status = stsmsgin();
-
-    return status;
+    return stsmsgin();
 }
 
-int32_t dp_enable(int32_t target, bool enable)
+dp_status_t dp_enable_nowait(int32_t target, bool enable)
 {
-    int32_t status;
+    dp_status_t status;
     uint8_t cmd[6] = {0x0e, 0x00, 0x00, 0x00, 0x00, 0x00};
     cmd[5] = enable ? 0x80 : 0x00;
 
     status = cmdout(sizeof(cmd), target, cmd);
-    if (status != 0) return -1;
+    if (status != DP_OK) return status;
 
-    status = stsmsgin();
+    return stsmsgin();
+}
+
+dp_status_t dp_enable(int32_t target, bool enable)
+{
+    dp_status_t status;
+
+    status = dp_enable_nowait(target, enable);
 
     wait_ms(1000);
 
     return status;
 }
 
-int32_t dp_recv(int32_t size, int32_t target, void *buffer)
+static dp_status_t recv_finish(int32_t size, void *buffer)
 {
-    int32_t status;
+    dp_status_t status;
+
+    /* 注入する故障はバスの状態を壊さないように転送を終えてから起こす */
+    status = stsmsgin();
+    if (status == DP_OK && FAULT(DP_FAULT_DATA)) return fail(DP_ERR_DATA);
+    if (status == DP_OK && FAULT(DP_FAULT_OVERSIZE))
+    {
+        ((uint8_t *)buffer)[0] = (size + 0x100) >> 8;
+        ((uint8_t *)buffer)[1] = (size + 0x100);
+    }
+    if (status == DP_OK && dp_recv_length(buffer) > 0)
+    {
+        dp_counters.rx_frames++;
+        dp_counters.rx_bytes += dp_recv_length(buffer);
+    }
+
+    return status;
+}
+
+dp_status_t dp_recv(int32_t size, int32_t target, void *buffer)
+{
+    dp_status_t status;
     uint8_t cmd[6] = {0x08, 0x00, 0x00, 0x00, 0x00, 0x00};
     cmd[4] = size;
     cmd[3] = size >> 8;
     cmd[5] = 0xc0;
 
     status = cmdout(sizeof(cmd), target, cmd);
-    if (status != 0) return -1;
+    if (status != DP_OK) return status;
 
-    status = _iocs_s_datain(size, buffer);
-    if (status == -1) return -1;
+    status = datain(size, buffer);
+    if (status != DP_OK) return status;
 
-    status = stsmsgin();
+    return recv_finish(size, buffer);
+}
+
+/*
+ * ヘッダを先に読み出して、フレームの長さだけ転送する
+ * 短いフレームは DMA の設定を省いてプログラム転送で読み出す
+ */
+dp_status_t dp_recv_sized(int32_t size, int32_t target, void *buffer)
+{
+    dp_status_t status;
+    uint8_t *p = buffer;
+    int32_t len;
+    uint8_t cmd[6] = {0x08, 0x00, 0x00, 0x00, 0x00, 0x00};
+    cmd[4] = size;
+    cmd[3] = size >> 8;
+    cmd[5] = 0xc0;
+
+    status = cmdout(sizeof(cmd), target, cmd);
+    if (status != DP_OK) return status;
+
+    status = datain_pio(DP_RECV_HEADER_SIZE, p);
+    if (status != DP_OK) return status;
+
+    /* 受信ウィンドウに収まらないフレームは従来どおりデバイスが転送を打ち切るまで読む */
+    len = dp_recv_length(p);
+    if (len > size - DP_RECV_HEADER_SIZE) len = size - DP_RECV_HEADER_SIZE;
+
+    if (len > DP_RECV_PIO_MAX)
+    {
+        status = datain(len, p + DP_RECV_HEADER_SIZE);
+    }
+    else if (len > 0)
+    {
+        status = datain_pio(len, p + DP_RECV_HEADER_SIZE);
+    }
+    if (status != DP_OK) return status;
+
+    return recv_finish(size, buffer);
+}
+
+/*
+ * 受信済みのフレームを最大 n 個まで続けて読み出す
+ * buffer には size バイトのスロットを n 個並べておく (各スロットはヘッダ + フレーム)
+ * デバイスに受信済みのフレームがなくなれば待たずに戻り、*count に読み出したフレーム数を返す
+ */
+dp_status_t dp_recv_batch(int32_t size, int32_t target, void *buffer, int32_t n, int32_t *count)
+{
+    dp_status_t status = DP_OK;
+    uint8_t *p = buffer;
+    int32_t i;
+
+    for (i = 0; i < n; )
+    {
+        status = dp_recv_sized(size, target, p);
+        if (status != DP_OK) break;
+        if (dp_recv_length(p) == 0) break;
+        i++;
+        if (!dp_recv_more(p)) break;
+        p += size;
+    }
+    *count = i;
 
     return status;
 }
 
-int32_t dp_send(int32_t size, int32_t target, void *buffer)
+dp_status_t dp_send(int32_t size, int32_t target, const void *buffer)
 {
-    int32_t status;
+    dp_status_t status;
     uint8_t cmd[6] = {0x0a, 0x00, 0x00, 0x00, 0x00, 0x00};
     cmd[4] = size;
     cmd[3] = size >> 8;
 
     status = cmdout(sizeof(cmd), target, cmd);
-    if (status != 0) return -1;
+    if (status != DP_OK) return status;
 
-    status = _iocs_s_dataout(size, buffer);
-    if (status == -1) return -1;
+    if (dp_transport->dataout(size, buffer) == -1) return fail(DP_ERR_DATA);
 
     status = stsmsgin();
+    if (status == DP_OK)
+    {
+        dp_counters.tx_frames++;
+        dp_counters.tx_bytes += size;
+    }
+
+    return status;
+}
+
+/* n 個のフレームを続けて送信し、*count に送信できたフレーム数を返す */
+dp_status_t dp_send_batch(int32_t target, const void *const *frames, const int32_t *sizes, int32_t n, int32_t *count)
+{
+    dp_status_t status = DP_OK;
+    int32_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        status = dp_send(sizes[i], target, frames[i]);
+        if (status != DP_OK) break;
+    }
+    *count = i;
 
     return status;
 }
 
+/*
+ * SCSI バスが使用中なら待たずに DP_ERR_BUSY を返す受信と送信
+ * 割り込み処理や常駐プログラムから、ディスクアクセスを妨げずに使える
+ */
+dp_status_t dp_try_recv(int32_t size, int32_t target, void *buffer)
+{
+    dp_status_t status;
+
+    if (!dp_bus_claim()) return DP_ERR_BUSY;
+    status = dp_recv_sized(size, target, buffer);
+    dp_bus_release();
+
+    return status;
+}
+
+dp_status_t dp_try_send(int32_t size, int32_t target, const void *buffer)
+{
+    dp_status_t status;
+
+    if (!dp_bus_claim()) return DP_ERR_BUSY;
+    status = dp_send(size, target, buffer);
+    dp_bus_release();
+
+    return status;
+}
+
+dp_status_t dp_wifi_info(int32_t target, struct dp_wifi_info *info)
+{
+    dp_status_t status;
+    int32_t size = sizeof(*info);
+    uint8_t cmd[6] = {0x1c, 0x04, 0x00, 0x00, 0x00, 0x00};    /* サブコマンドは cdb[1] */
+    cmd[4] = size;
+    cmd[3] = size >> 8;
+
+    status = cmdout(sizeof(cmd), target, cmd);
+    if (status != DP_OK) return status;
+
+    status = datain(size, info);
+    if (status != DP_OK) return status;
+
+    return stsmsgin();
+}
+
 bool dp_is_daynaport(struct dp_inquiry_data *data)
 {
     bool ret = false;
@@ -202,14 +402,33 @@ bool dp_is_daynaport(struct dp_inquiry_data *data)
     return ret;
 }
 
-bool dp_is_in_iocs(void)
+bool dp_is_free(void)
 {
-    volatile int16_t *iniocs = (short*)0x0a0e;
-    return (*iniocs != -1);
+    int32_t phase = dp_transport->phase();
+    return (phase == 0);
 }
 
-bool dp_is_free(void)
+/* ドライバが SCSI バスを使用中かどうか (割り込みの入り口でも参照する) */
+volatile uint8_t dp_bus_busy = false;
+
+/* SCSI バスの使用権を得る (割り込み禁止区間はこの中だけ) */
+bool dp_bus_claim(void)
 {
-    int32_t phase = _iocs_s_phase();
-    return (phase == 0);
+    bool ret = false;
+    uint16_t sr;
+
+    sr = dp_irq_disable();
+    if (!dp_bus_busy && dp_is_free())
+    {
+        dp_bus_busy = true;
+        ret = true;
+    }
+    dp_irq_enable(sr);
+
+    return ret;
+}
+
+void dp_bus_release(void)
+{
+    dp_bus_busy = false;
 }
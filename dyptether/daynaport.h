@@ -28,6 +28,61 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+ * DaynaPORT SCSI/Link のプロトコルライブラリ
+ * dyptether.x 以外のツールからも使えるように、SCSI コマンドの発行と
+ * READ ヘッダの解析、SCSI バスの使用権の管理だけを行う
+ *
+ * プロトコル本体 (daynaport.c) はハードウェアに触れず、以下のプラットフォーム依存部を
+ * 別のファイルで実装する (X68000 では daynaport_iocs.c、ホストでは host/dp_host.c)
+ *   dp_transport とその初期値、dp_set_transport()
+ *   dp_ontime(), dp_timestamp(), dp_is_in_iocs()
+ */
+
+/* dp_* 関数の戻り値 */
+typedef enum
+{
+    DP_OK = 0,
+    DP_ERR_SELECT = -1,     /* セレクションに失敗した */
+    DP_ERR_COMMAND = -2,    /* コマンドフェーズでエラーが発生した */
+    DP_ERR_DATA = -3,       /* データフェーズでエラーが発生した */
+    DP_ERR_STSMSG = -4,     /* ステータス/メッセージフェーズでエラーが発生した */
+    DP_ERR_CHECK = -5,      /* ステータスが GOOD ではなかった */
+    DP_ERR_BUSY = -6,       /* SCSI バスが使用中だった (dp_try_* のみ) */
+} dp_status_t;
+
+/*
+ * SCSI の各フェーズを実行するトランスポート
+ * 戻り値は IOCS の SCSI コールに合わせる (0 または転送結果、失敗は -1 など)
+ * X68000 でのデフォルトは IOCS を使う dp_iocs_transport で、SPC を直接操作する実装や
+ * ホスト上のシミュレータに dp_set_transport() で差し替えられる
+ */
+struct dp_transport
+{
+    int32_t (*select)(int32_t target);
+    int32_t (*cmdout)(int32_t size, const uint8_t *cmd);
+    int32_t (*datain)(int32_t size, void *buffer);          /* 長い転送 (DMA) */
+    int32_t (*datain_pio)(int32_t size, void *buffer);      /* 短い転送 (プログラム転送) */
+    int32_t (*dataout)(int32_t size, const void *buffer);
+    int32_t (*stsin)(uint8_t *sts);
+    int32_t (*msgin)(uint8_t *msg);
+    int32_t (*inquiry)(int32_t size, int32_t target, void *buffer);
+    int32_t (*phase)(void);                                 /* 0 ならバスフリー */
+};
+
+/* ライブラリ内で数えているカウンタ (利用者がゼロクリアしてよい) */
+struct dp_counters
+{
+    uint32_t commands;      /* 発行したコマンド数 */
+    uint32_t errors;        /* エラーで終わったコマンド数 */
+    uint32_t rx_frames;     /* 受信したフレーム数 */
+    uint32_t rx_bytes;      /* 受信したフレームのバイト数 (FCS を含む) */
+    uint32_t tx_frames;     /* 送信したフレーム数 */
+    uint32_t tx_bytes;      /* 送信したフレームのバイト数 */
+};
+
+#define DP_CDB_MAX      10
+
 struct dp_inquiry_data
 {
     uint8_t unit;
@@ -43,6 +98,68 @@ struct dp_inquiry_data
     uint8_t extra[8];
 };
 
+/* READ (0x08) のレスポンスヘッダ (長さ 2バイト + フラグ 4バイト) */
+#define DP_RECV_HEADER_SIZE     6
+#define DP_RECV_FLAG_MORE       0x10    /* ヘッダ +5: デバイスに受信済みのフレームが残っている */
+#define DP_RECV_PIO_MAX         128     /* これ以下の長さのフレームは DMA を使わずに転送する */
+
+/* READ のヘッダからフレーム長 (FCS を含む) を取り出す */
+static inline int32_t dp_recv_length(const void *header)
+{
+    const uint8_t *p = header;
+    return (p[0] << 8) | p[1];
+}
+
+/* READ のヘッダから、デバイスに次のフレームが残っているかどうかを取り出す */
+static inline bool dp_recv_more(const void *header)
+{
+    const uint8_t *p = header;
+    return dp_recv_length(p) > 0 && (p[5] & DP_RECV_FLAG_MORE);
+}
+
+/* RETRIEVE STATISTICS (0x09) のレスポンス */
+struct dp_stat_data
+{
+    uint8_t mac[6];
+    uint32_t frame_alignment_errors;
+    uint32_t crc_errors;
+    uint32_t frames_lost;
+} __attribute__((packed, aligned(2)));
+
+/* BlueSCSI Wi-Fi 情報 (0x1c/0x04) のレスポンス */
+struct dp_wifi_info
+{
+    uint16_t size;
+    char ssid[64];
+    uint8_t bssid[6];
+    int8_t rssi;
+    uint8_t channel;
+    uint8_t flags;
+    uint8_t padding;
+} __attribute__((packed, aligned(2)));
+
+/* 故障注入の種別 */
+enum
+{
+    DP_FAULT_SELECT,        /* セレクションの失敗 */
+    DP_FAULT_DATA,          /* データフェーズの失敗 */
+    DP_FAULT_STATUS,        /* ステータスが GOOD ではない */
+    DP_FAULT_OVERSIZE,      /* 受信ウィンドウを超える長さのフレーム */
+    DP_FAULT_NUM
+};
+
+/* 故障注入の設定と注入した回数 (DP_FAULT_INJECT を定義してビルドした時のみ有効) */
+struct dp_fault_config
+{
+    uint32_t seed;                      /* 乱数の種 (同じ種なら同じ順序で故障が起きる) */
+    uint16_t rate[DP_FAULT_NUM];        /* 発生率 (1/65536 単位) */
+    uint32_t injected[DP_FAULT_NUM];    /* 注入した回数 */
+};
+
+/* SCSI 転送中に設定する割り込みマスクレベル (SCC/MFP 割り込みは受け付ける) */
+#define DP_XFER_IPL     4
+
+#ifdef __m68k__
 static inline __attribute__((always_inline)) uint16_t dp_irq_disable(void)
 {
     uint16_t sr;
@@ -66,14 +183,121 @@ static inline __attribute__((always_inline)) void dp_irq_enable(uint16_t sr)
     );
 }
 
-int32_t dp_inquiry(int32_t target, struct dp_inquiry_data *data);
-int32_t dp_stat(int32_t size, int32_t target, void *buffer);
-int32_t dp_enable(int32_t target, bool enable);
-int32_t dp_recv(int32_t size, int32_t target, void *buffer);
-int32_t dp_send(int32_t size, int32_t target, void *buffer);
+static inline __attribute__((always_inline)) uint16_t dp_irq_lower(uint16_t level)
+{
+    uint16_t sr;
+    uint16_t newsr;
+    __asm__ volatile (
+        "move.w %%sr,%0\n"
+        : "=d"(sr)
+        :
+        : "memory"
+    );
+    if ((sr & 0x0700) > (level << 8))
+    {
+        newsr = (sr & 0xf8ff) | (level << 8);
+        __asm__ volatile(
+            "move.w %0,%%sr\n"
+            :
+            : "d"(newsr)
+            : "memory"
+        );
+    }
+    return sr;
+}
+
+static inline __attribute__((always_inline)) uint16_t dp_irq_raise(uint16_t level)
+{
+    uint16_t sr;
+    uint16_t newsr;
+    __asm__ volatile (
+        "move.w %%sr,%0\n"
+        : "=d"(sr)
+        :
+        : "memory"
+    );
+    if ((sr & 0x0700) < (level << 8))
+    {
+        newsr = (sr & 0xf8ff) | (level << 8);
+        __asm__ volatile(
+            "move.w %0,%%sr\n"
+            :
+            : "d"(newsr)
+            : "memory"
+        );
+    }
+    return sr;
+}
+#else
+/* ホスト上では割り込みがないので、ステータスレジスタの割り込みマスクだけを模す */
+extern uint16_t dp_host_sr;
+
+static inline uint16_t dp_irq_disable(void)
+{
+    uint16_t sr = dp_host_sr;
+    dp_host_sr |= 0x0700;
+    return sr;
+}
+
+static inline void dp_irq_enable(uint16_t sr)
+{
+    dp_host_sr = sr;
+}
+
+static inline uint16_t dp_irq_lower(uint16_t level)
+{
+    uint16_t sr = dp_host_sr;
+    if ((sr & 0x0700) > (level << 8))
+    {
+        dp_host_sr = (sr & 0xf8ff) | (level << 8);
+    }
+    return sr;
+}
 
+static inline uint16_t dp_irq_raise(uint16_t level)
+{
+    uint16_t sr = dp_host_sr;
+    if ((sr & 0x0700) < (level << 8))
+    {
+        dp_host_sr = (sr & 0xf8ff) | (level << 8);
+    }
+    return sr;
+}
+#endif
+
+dp_status_t dp_inquiry(int32_t target, struct dp_inquiry_data *data);
+dp_status_t dp_stat(int32_t size, int32_t target, void *buffer);
+dp_status_t dp_enable(int32_t target, bool enable);
+dp_status_t dp_enable_nowait(int32_t target, bool enable);
+dp_status_t dp_recv(int32_t size, int32_t target, void *buffer);
+dp_status_t dp_recv_sized(int32_t size, int32_t target, void *buffer);
+dp_status_t dp_recv_batch(int32_t size, int32_t target, void *buffer, int32_t n, int32_t *count);
+dp_status_t dp_send(int32_t size, int32_t target, const void *buffer);
+dp_status_t dp_send_batch(int32_t target, const void *const *frames, const int32_t *sizes, int32_t n, int32_t *count);
+dp_status_t dp_try_recv(int32_t size, int32_t target, void *buffer);
+dp_status_t dp_try_send(int32_t size, int32_t target, const void *buffer);
+dp_status_t dp_wifi_info(int32_t target, struct dp_wifi_info *info);
+
+extern struct dp_counters dp_counters;
+uint32_t dp_elapsed(uint32_t start, uint32_t end);
 bool dp_is_daynaport(struct dp_inquiry_data *data);
-bool dp_is_in_iocs(void);
 bool dp_is_free(void);
 
+/* プラットフォーム依存部 */
+extern const struct dp_transport dp_iocs_transport;
+extern const struct dp_transport *dp_transport;
+void dp_set_transport(const struct dp_transport *transport);
+uint32_t dp_ontime(void);
+uint32_t dp_timestamp(void);
+bool dp_is_in_iocs(void);
+
+#ifdef DP_FAULT_INJECT
+extern struct dp_fault_config dp_fault;
+void dp_fault_setup(const struct dp_fault_config *config);
+#endif
+
+extern volatile uint8_t dp_bus_busy;
+bool dp_bus_claim(void);
+void dp_bus_release(void);
+
 #endif /* DAYNAPORT_H */
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * X68000 用のプラットフォーム依存部
+ * IOCS の SCSI コールによるトランスポートと、タイマーと IOCS 実行中の判定を実装する
+ * プロトコル本体 (daynaport.c) はこのファイルを差し替えればホスト上でもビルドできる
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <x68k/iocs.h>
+
+#include "daynaport.h"
+
+int32_t _iocs_s_dataini(int, void *);
+__asm__(
+".global _iocs_s_dataini\n"
+".type _iocs_s_dataini,@function\n"
+"_iocs_s_dataini:\n"
+"	move.l	%d3, %sp@-\n"
+"	movem.l	%sp@(8),%d3/%a1\n"
+"	moveq	#11, %d1\n"
+"	moveq	#0xfffffff5, %d0\n"
+"	trap	#15\n"
+"	move.l	%sp@+, %d3\n"
+"	rts\n"
+);
+
+uint32_t dp_ontime(void)
+{
+    struct iocs_time t;
+    t = _iocs_ontime();
+    return t.day * (24*60*60*100) + t.sec;
+}
+
+/* 50us 単位のタイムスタンプ (Timer-C のカウンタで dp_ontime を補間する) */
+uint32_t dp_timestamp(void)
+{
+    volatile uint8_t *tcdr = (uint8_t *)0xe88023;
+    uint32_t t;
+    uint8_t c1;
+    uint8_t c2;
+
+    /* カウンタはダウンカウントなので、途中で再ロードされたら読み直す */
+    do
+    {
+        c1 = *tcdr;
+        t = dp_ontime();
+        c2 = *tcdr;
+    }
+    while (c2 > c1);
+
+    return t * 200 + (200 - c2);
+}
+
+bool dp_is_in_iocs(void)
+{
+    volatile int16_t *iniocs = (short*)0x0a0e;
+    return (*iniocs != -1);
+}
+
+/* IOCS の SCSI コールによるトランスポート */
+static int32_t iocs_select(int32_t target)
+{
+    return _iocs_s_select(target);
+}
+
+static int32_t iocs_cmdout(int32_t size, const uint8_t *cmd)
+{
+    return _iocs_s_cmdout(size, (void *)cmd);
+}
+
+static int32_t iocs_datain(int32_t size, void *buffer)
+{
+    return _iocs_s_datain(size, buffer);
+}
+
+static int32_t iocs_datain_pio(int32_t size, void *buffer)
+{
+    return _iocs_s_dataini(size, buffer);
+}
+
+static int32_t iocs_dataout(int32_t size, const void *buffer)
+{
+    return _iocs_s_dataout(size, (void *)buffer);
+}
+
+static int32_t iocs_stsin(uint8_t *sts)
+{
+    return _iocs_s_stsin(sts);
+}
+
+static int32_t iocs_msgin(uint8_t *msg)
+{
+    return _iocs_s_msgin(msg);
+}
+
+static int32_t iocs_inquiry(int32_t size, int32_t target, void *buffer)
+{
+    return _iocs_s_inquiry(size, target, buffer);
+}
+
+static int32_t iocs_phase(void)
+{
+    return _iocs_s_phase();
+}
+
+const struct dp_transport dp_iocs_transport =
+{
+    .select = iocs_select,
+    .cmdout = iocs_cmdout,
+    .datain = iocs_datain,
+    .datain_pio = iocs_datain_pio,
+    .dataout = iocs_dataout,
+    .stsin = iocs_stsin,
+    .msgin = iocs_msgin,
+    .inquiry = iocs_inquiry,
+    .phase = iocs_phase,
+};
+
+const struct dp_transport *dp_transport = &dp_iocs_transport;
+
+void dp_set_transport(const struct dp_transport *transport)
+{
+    dp_transport = transport ? transport : &dp_iocs_transport;
+}
@@ -30,9 +30,9 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
-#include <setjmp.h>
 
 #include <x68k/iocs.h>
 #include <x68k/dos.h>
@@ -44,17 +44,101 @@
 // Definition
 //****************************************************************************
 
-// dyptbuf usage (0x000 - 0xf80)
-#define DYPTBUF_TEMP        0x000   // 0x000 - 0x007
-#define DYPTBUF_SEND        0x010   // 0x010 - 0x77f
-#define DYPTBUF_SENDDATA    0x010
-#define DYPTBUF_RECV        0x780   // 0x780 - 0xf7f
-#define DYPTBUF_RECVDATA    0x786
+// バッファ構成のデフォルト (make MTU=... RXSLOTS=... TXDEPTH=... で変更でき、起動時のオプションでも指定できる)
+#ifndef DYPT_MTU
+#define DYPT_MTU            1500
+#endif
+#ifndef DYPT_RX_SLOTS
+#define DYPT_RX_SLOTS       1       // 1回のポーリングでまとめて配送するフレーム数
+#endif
+#ifndef DYPT_TX_DEPTH
+#define DYPT_TX_DEPTH       2       // SCSI バスが空くまで待たせておける送信フレーム数
+#endif
+#define MTU_MIN             576
+#define MTU_MAX             1500
+#define SLOTS_MAX           8
+
+#define ETH_HLEN            14
+#define ETH_ZLEN            60      // FCSを除いた最小フレーム長
+#define ETH_FCS_LEN         4
+#define ETH_TYPE_IP         0x0800
+#define ETH_TYPE_ARP        0x0806
+#define IP_PROTO_ICMP       1
+#define IP_PROTO_TCP        6
+#define TCP_FLAG_FIN        0x01
+#define TCP_FLAG_RST        0x04
+
+#ifdef __m68k__
+#define RD16(p)             (*(uint16_t *)(p))
+#else
+// ホストでの soak テストのビルドでは、ビッグエンディアンとして読み書きする
+struct be16 { uint16_t v; } __attribute__((packed, scalar_storage_order("big-endian")));
+#define RD16(p)             (((struct be16 *)(p))->v)
+#endif
+
+// 優先クラスの送信キュー (小さいフレーム専用なのでスロットも小さくする)
+#define TX_PRIO_LEN         128     // 優先クラスにするフレームの最大長
+#define TX_PRIO_DEPTH       4
+#define TX_PRIO_BURST       4       // 通常クラスを待たせて続けて送る優先クラスのフレーム数
+
+// 受信スロットは READ のヘッダ (6バイト) の後にフレームが続き、送信スロットは
+// 下の struct txslot の後にフレームが続く。どちらもスロットを 4バイト境界に置くと
+// フレームは 4n+2 バイト目から始まり、IP ヘッダが 4バイト境界になる
+#define SLOT_ALIGN(n)       (((n) + 3) & ~3)
+#define TX_PRIO_SLOT_SIZE   SLOT_ALIGN(offsetof(struct txslot, frame) + TX_PRIO_LEN)
+#define RXSLOT(ifp, i)      ((ifp)->rxbuf + (i) * regp->rxslot_size)
+#define TXSLOT(q, i)        ((struct txslot *)((q)->buf + (i) * (q)->slot_size))
+
+// 1つのドライバで扱うネットワークインターフェース数 (head.S のデバイスヘッダ数と合わせる)
+#define N_IFACE             2
 
 #define IRQ_GPIO4           0
 #define IRQ_TIMERA          1
 #define IRQ_TIMERC          2
-
+#define IRQ_THREAD          3       // 割り込みではなくバックグラウンドスレッドでポーリングする
+
+// ポーリングスレッドの設定 (/i3)
+#define THREAD_STACK_SIZE   8192    // スーパーバイザスタック (プロトコルハンドラもこの上で動く)
+#define THREAD_USTACK_SIZE  256
+#define THREAD_COUNTER      2       // スレッドの実行カウンタ
+#define THREAD_IDLE_MS      100     // ポーリングが不要な間のスリープ時間
+#define MFP_IPL             6       // MFP の割り込みレベル (ポーリング割り込みの処理中と同じ)
+#define MFP_TIMERD          0x10    // IMRB の Timer-D (プロセス切り替え) のビット
+
+// ポーリングの自動調整 (/c)
+#define CAL_SAMPLES         8       // SCSI コマンドの時間を計測する回数
+#define CAL_VDISP_FRAMES    4       // 垂直同期の周期を計測するフレーム数
+#define CAL_EDGE_TIMEOUT    2000    // 垂直同期信号の変化を待つ時間 (50us単位)
+#define CAL_TARGET_DEFAULT  5       // 目標とする受信遅延のデフォルト (10ms単位)
+#define CAL_CPU_PERMIL      50      // ポーリングに使ってよい CPU 時間 (1/1000単位)
+#define TIMERC_PERIOD       200     // Timer-C 割り込み (スレッドのスリープ) の周期 (50us単位)
+#define MFP_GPIP_VDISP      0x10    // GPIP の V-DISP のビット
+
+// 1回のポーリングで受信に使う時間のデフォルト (50us単位)
+#define BUS_BUDGET_DEFAULT  20
+
+// リンク状態の確認間隔 (10ms単位)
+#define LINK_CHECK_INTERVAL     200     // リンク接続中
+#define LINK_CHECK_DOWN_MIN     50      // リンク切断中 (確認ごとに倍にする)
+#define LINK_CHECK_DOWN_MAX     400
+
+// リンク状態を取得できるかどうか
+#define LINKINFO_UNKNOWN        0
+#define LINKINFO_SUPPORTED      1
+#define LINKINFO_UNSUPPORTED    2
+
+// エラー回復の状態
+#define RECOVERY_NONE       0   // 正常動作中
+#define RECOVERY_PROBE      1   // dp_inquiry でデバイスを再検出する
+#define RECOVERY_ENABLE     2   // dp_enable でデバイスを再初期化する
+#define RECOVERY_SETTLE     3   // 初期化の完了を待って MAC アドレスを読み直す
+
+// エラー回復の待ち時間 (10ms単位)
+#define RECOVERY_SETTLE_TIME    100
+#define RECOVERY_BACKOFF_MIN    50
+#define RECOVERY_BACKOFF_MAX    3200
+
+volatile uint8_t *const mfp_gpip = (uint8_t *)0xe88001;
 volatile uint8_t *const mfp_aeb = (uint8_t *)0xe88003;
 volatile uint8_t *const mfp_ierb = (uint8_t *)0xe88009;
 volatile uint8_t *const mfp_imrb = (uint8_t *)0xe88015;
@@ -67,54 +151,132 @@ typedef void (*rcvhandler_t)(int len, uint8_t *buff, uint32_t flag);
 
 struct dos_req_header *reqheader;         // Human68kからのリクエストヘッダ
 
-struct regdata {
+#define N_PROTO_HANDLER   8
+
+// 送信キューのスロット
+struct txslot {
+  uint32_t queued;  // キューに入れた時刻 (50us単位)
+  uint16_t len;     // フレーム長 (0 ならフレームを書き込み中)
+  uint8_t frame[];
+};
+
+// 送信クラスごとの送信キュー (リングバッファ)
+struct txqueue {
+  uint8_t *buf;     // スロットの並び
+  int slot_size;    // スロット1つのサイズ
+  int depth;        // スロット数
+  int head;         // 次に送信するスロット
+  int count;        // 確保済みのスロット数
+};
+
+// ネットワークインターフェースごとのデータ
+struct ifdata {
   void *oldtrap;    // trap ベクタ変更前のアドレス
-  void *oldivaddr;  // 割り込みベクタ変更前のアドレス
   char ifname[4];   // ネットワークインターフェース名
 
-  int removable;    // 0:CONFIG.SYSで登録された 1:Human68k起動後に登録された
-  int irqtype;      // 割り込み種別
   int trapno;       // 使用するtrap番号 (0-7)
   int target;       // SCSIターゲットID
   int nproto;       // このインターフェースを使用するプロトコル数
-} regdata = {
-  .ifname = "en0",
-  .trapno = 0,
-  .nproto = 0,
+  int rxenabled;    // デバイスの受信が有効になっているかどうか
+  int sentpacket;   // 送信済みパケットがある
+  int linkinfo;     // リンク状態を取得できるかどうか
+  uint32_t link_next;     // 次にリンク状態を確認する時刻
+  uint32_t link_interval; // リンク状態の確認間隔
+  int macvalid;     // macaddr が有効かどうか
+  uint8_t macaddr[6]; // キャッシュしている MAC アドレス
+  int ipvalid;      // ipaddr が有効かどうか
+  uint8_t ipaddr[4];  // ARP/ICMP echo の応答に使う IP アドレス
+
+  int recovery;             // エラー回復の状態
+  uint32_t recovery_start;  // エラー回復を開始した時刻
+  uint32_t recovery_next;   // 次にエラー回復を試行する時刻
+  uint32_t recovery_backoff; // 次の失敗時に待つ時間
+  struct dypt_stats stats;  // 統計情報
+  struct dypt_latency latency; // 遅延ヒストグラム
+  uint32_t last_poll;       // 前回の受信が終わった時刻 (50us単位)
+
+  struct {
+    int proto;
+    rcvhandler_t func;
+  } proto_handler[N_PROTO_HANDLER];
+
+  uint8_t *rxbuf;           // 受信スロット (regp->rxslots 個)
+  struct txqueue txq[DYPT_TX_CLASSES]; // 送信キュー
+  int tx_prio_run;          // 通常クラスを待たせて続けて送った優先クラスのフレーム数
+  int tx_bulk_fence;        // 通常クラスに回した優先クラスのフレームを送り終えるまでに送る通常クラスの数
+};
 
-  .irqtype = IRQ_GPIO4,
+static struct ifdata ifdata[N_IFACE];
+
+struct regdata {
+  void *oldivaddr;  // 割り込みベクタ変更前のアドレス
 
-  .target = -1,
+  int removable;    // 0:CONFIG.SYSで登録された 1:Human68k起動後に登録された
+  int irqtype;      // 割り込み種別
+  int budget;       // 1回のポーリングで受信に使う時間 (50us単位)
+  int offload;      // ARP/ICMP echo をドライバ内で応答するかどうか
+  int fixedrecv;    // 受信ヘッダを見ずに常に受信ウィンドウ全体を要求するかどうか
+  int mtu;          // MTU
+  int rxslots;      // 受信スロット数
+  int txdepth;      // 送信キューの長さ
+  int rxwindow;     // 1回の READ で要求する長さ (ヘッダ + フレーム + FCS)
+  int rxslot_size;  // 受信スロット1つのサイズ
+  int txslot_size;  // 送信スロット1つのサイズ
+  uint8_t *bufend;  // 送受信バッファの終わり (常駐部分の終わり)
+  uint8_t *thread_stack;      // ポーリングスレッドのスタック
+  volatile int thread_exit;   // ポーリングスレッドに終了を要求する
+  volatile int thread_running; // ポーリングスレッドが動作中かどうか
+  int nif;          // 使用するネットワークインターフェース数
+  struct ifdata *ifs; // ネットワークインターフェースごとのデータ
+} regdata = {
+  .irqtype = IRQ_GPIO4,
+  .budget = BUS_BUDGET_DEFAULT,
+  .mtu = DYPT_MTU,
+  .rxslots = DYPT_RX_SLOTS,
+  .txdepth = DYPT_TX_DEPTH,
+  .nif = 0,
+  .ifs = ifdata,
 };
 
 struct regdata *regp = &regdata;
 extern struct dos_dev_header devheader;
-extern void trap_entry(void);
+extern struct dos_dev_header *const devheader_table[N_IFACE];
+extern void *const trap_entry_table[N_IFACE];
 extern void inthandler_gpio4_asm(void);
 extern void inthandler_timer_a_asm(void);
 extern void inthandler_timer_c_asm(void);
 
 uint16_t irq_count;
 uint16_t irq_count_ini = 4;
+volatile uint8_t poll_retry;            // 見送ったポーリングを次の割り込みで再試行する
+volatile uint8_t poll_active;           // ポーリングが必要なインターフェースがある
+uint32_t poll_deferred_fast;            // 割り込みの入り口でポーリングを見送った回数
 void *old_timer_c;
 
 //****************************************************************************
 // Static variables
 //****************************************************************************
 
-static jmp_buf jenv;                      // DaynaPORT通信エラー時のジャンプ先
-static int inrecovery = false;            // 通信エラー回復中
-static int hotplug = false;               // 接続状態が変化した
-static int sentpacket = false;            // 送信済みパケットがある
 static int flag_r = false;                // 常駐解除フラグ
-
-#define N_PROTO_HANDLER   8
+static int ntarget = 0;                   // /d で指定された SCSI ID の数
+static int ntrapno = 0;                   // /t で指定された trap 番号の数
+static struct dos_prcctrl thread_ctrl;    // ポーリングスレッドのプロセス間通信バッファ (使用しない)
+static uint8_t *memlimit = NULL;          // 常駐に使えるメモリの終わり (CONFIG.SYS では確認しない)
+static int cal_target = 0;                // /c で指定された目標の受信遅延 (10ms単位、0:自動調整しない)
+static struct dp_stat_data statdata;
+static struct dp_inquiry_data inquiry;
+
+// ポーリングの自動調整の計測結果
 static struct {
-  int proto;
-  rcvhandler_t func;
-} proto_handler[N_PROTO_HANDLER];
+  uint32_t stat_cost;       // dp_stat に要した時間 (50us単位、CAL_SAMPLES 回の合計)
+  uint32_t recv_cost;       // 空の受信に要した時間 (50us単位、CAL_SAMPLES 回の合計)
+  uint32_t vdisp_period;    // 垂直同期の周期 (50us単位、計測できなければ 0)
+  uint32_t interval;        // 選んだポーリング間隔 (50us単位)
+  bool met;                 // 目標の受信遅延を満たせたかどうか
+} cal;
 
-static uint8_t dyptbuf[0x1000];
+static const char *const irqname[] = { "V-DISP", "Timer-A", "Timer-C", "THREAD" };
+static struct dp_wifi_info wifiinfo;
 
 //****************************************************************************
 // for debugging
@@ -177,7 +339,6 @@ static int find_dyptether(struct dos_dev_header **res)
   while (devh->next != (struct dos_dev_header *)-1) {
     char *p = devh->next->name;
     if (memcmp(p, "/dev/", 5) == 0 &&
-        memcmp(p + 5, regp->ifname, 3) == 0 &&
         memcmp(p + 8, "EthDDyPT", 8) == 0) {
       *res = devh;
       return 1; // 常駐していた場合は一つ前のデバイスヘッダへのポインタを返す
@@ -189,14 +350,18 @@ static int find_dyptether(struct dos_dev_header **res)
 }
 
 // trap #0～#7のうち使用可能なものがあるかをチェック
-static int find_unused_trap(int defno)
+// used は他のインターフェースに割り当て済みの trap 番号のビットマスク
+static int find_unused_trap(int defno, int used)
 {
-  if (defno >= 0) {
+  if (defno >= 0 && !(used & (1 << defno))) {
     if ((uint32_t)_dos_intvcg(0x20 + defno) & 0xff000000) {
       return defno;
     }
   }
   for (int i = 0; i < 8; i++) {
+    if (used & (1 << i)) {
+      continue;
+    }
     if ((uint32_t)_dos_intvcg(0x20 + i) & 0xff000000) {
       return i;
     }
@@ -219,267 +384,1444 @@ void msleep(int time)
   }
 }
 
-unsigned long hextoul(const char *p, char **endp)
+unsigned long hextoul(const char *p, char **endp)
+{
+  unsigned long val = 0;
+  while (1) {
+    char c = tolower(*p++);
+    if (c >= '0' && c <= '9') {
+      val = val * 16 + c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      val = val * 16 + c - 'a' + 10;
+    } else {
+      break;
+    }
+  }
+  if (endp) {
+    *endp = (char *)p - 1;
+  }
+  return val;
+}
+
+// 送信キューにフレームが残っているかどうか
+static bool tx_pending(struct ifdata *ifp)
+{
+  return ifp->txq[DYPT_TX_PRIO].count > 0 || ifp->txq[DYPT_TX_BULK].count > 0;
+}
+
+// ポーリングが必要なインターフェースがあるかどうかを割り込みの入り口に知らせる
+static void update_poll_active(void)
+{
+  bool active = false;
+  for (int i = 0; i < regp->nif; i++) {
+    struct ifdata *ifp = &regp->ifs[i];
+    if (ifp->nproto > 0 || ifp->rxenabled || ifp->recovery != RECOVERY_NONE ||
+        tx_pending(ifp)) {
+      active = true;
+    }
+  }
+  poll_active = active;
+}
+
+// 遅延ヒストグラムに加える
+static void hist_add(struct dypt_hist *h, uint32_t t)
+{
+  int i = 0;
+  while (t != 0 && i < DYPT_HIST_BUCKETS - 1) {
+    t >>= 1;
+    i++;
+  }
+  h->bucket[i]++;
+}
+
+//----------------------------------------------------------------------------
+// SCSI bus
+//----------------------------------------------------------------------------
+
+static uint8_t timerd_saved;    // 使用権を得る前の IMRB の Timer-D のビット
+
+// SCSI バスの使用権を得る
+// スレッドでポーリングしている時は SCSI の処理を割り込みを許可したまま行うので、処理の途中で
+// プロセスが切り替わってフォアグラウンドがディスクの IOCS コールを始めないよう、使用権を解放する
+// までプロセス切り替えの Timer-D 割り込みを止める (止めている間の割り込みは MFP に保留される)
+static bool bus_claim(void)
+{
+  uint16_t sr;
+
+  if (regp->irqtype != IRQ_THREAD) {
+    return dp_bus_claim();
+  }
+  sr = dp_irq_disable();
+  uint8_t saved = *mfp_imrb & MFP_TIMERD;
+  *mfp_imrb &= ~MFP_TIMERD;
+  dp_irq_enable(sr);
+  // Timer-D を止めてから確かめ直すので、使用権を得た後にディスクの IOCS コールが割り込むことはない
+  if (dp_is_in_iocs() || !dp_bus_claim()) {
+    sr = dp_irq_disable();
+    *mfp_imrb |= saved;
+    dp_irq_enable(sr);
+    return false;
+  }
+  timerd_saved = saved;
+  return true;
+}
+
+// SCSI バスの使用権を解放する
+static void bus_release(void)
+{
+  dp_bus_release();
+  if (regp->irqtype == IRQ_THREAD && timerd_saved) {
+    uint16_t sr = dp_irq_disable();
+    *mfp_imrb |= timerd_saved;
+    dp_irq_enable(sr);
+  }
+}
+
+//----------------------------------------------------------------------------
+// MAC address cache
+//----------------------------------------------------------------------------
+
+// デバイスから MAC アドレスを読み出してキャッシュする
+static dp_status_t read_macaddr(struct ifdata *ifp)
+{
+  dp_status_t status = dp_stat(sizeof(statdata), ifp->target, &statdata);
+  if (status != DP_OK) {
+    return status;
+  }
+  memcpy(ifp->macaddr, statdata.mac, 6);
+  ifp->macvalid = true;
+  return DP_OK;
+}
+
+// デバイスのリセットやエラー回復時にキャッシュを破棄する
+static void invalidate_macaddr(struct ifdata *ifp)
+{
+  ifp->macvalid = false;
+}
+
+//----------------------------------------------------------------------------
+// Error recovery
+//----------------------------------------------------------------------------
+
+// 通信エラーを検出したのでエラー回復を開始する
+static void start_recovery(struct ifdata *ifp, dp_status_t err)
+{
+  ifp->stats.errors++;
+  ifp->stats.last_error = err;
+  if (ifp->recovery != RECOVERY_NONE) {
+    return;
+  }
+  DPRINTF("start recovery\r\n");
+  invalidate_macaddr(ifp);
+  ifp->sentpacket = false;
+  // 送信待ちのフレームは破棄する (書き込み中のスロットは残す)
+  uint16_t sr = dp_irq_disable();
+  for (int c = 0; c < DYPT_TX_CLASSES; c++) {
+    struct txqueue *q = &ifp->txq[c];
+    while (q->count > 0 && TXSLOT(q, q->head)->len != 0) {
+      TXSLOT(q, q->head)->len = 0;
+      if (++q->head == q->depth) {
+        q->head = 0;
+      }
+      q->count--;
+      if (c == DYPT_TX_BULK && ifp->tx_bulk_fence > 0) {
+        ifp->tx_bulk_fence--;
+      }
+    }
+  }
+  dp_irq_enable(sr);
+  ifp->recovery_start = ifp->recovery_next = dp_ontime();
+  ifp->recovery_backoff = RECOVERY_BACKOFF_MIN;
+  ifp->recovery = RECOVERY_PROBE;
+  poll_active = true;
+}
+
+// エラー回復に失敗したので、待ち時間を倍にして再検出からやり直す
+static void retry_recovery(struct ifdata *ifp, uint32_t now)
+{
+  ifp->stats.recovery_fails++;
+  ifp->recovery = RECOVERY_PROBE;
+  ifp->recovery_next = now + ifp->recovery_backoff;
+  if (ifp->recovery_backoff < RECOVERY_BACKOFF_MAX) {
+    ifp->recovery_backoff *= 2;
+  }
+}
+
+// エラー回復の状態を1つ進める (ポーリング割り込みから SCSI バスが空いている時に呼ばれる)
+static void step_recovery(struct ifdata *ifp)
+{
+  uint32_t now = dp_ontime();
+  if ((int32_t)(now - ifp->recovery_next) < 0) {
+    return;
+  }
+
+  switch (ifp->recovery) {
+  case RECOVERY_PROBE:
+    if (dp_inquiry(ifp->target, &inquiry) != DP_OK || !dp_is_daynaport(&inquiry)) {
+      retry_recovery(ifp, now);
+      break;
+    }
+    ifp->recovery = RECOVERY_ENABLE;
+    // fall through
+  case RECOVERY_ENABLE:
+    if (dp_enable_nowait(ifp->target, ifp->nproto > 0) != DP_OK) {
+      retry_recovery(ifp, now);
+      break;
+    }
+    ifp->rxenabled = (ifp->nproto > 0);
+    ifp->recovery = RECOVERY_SETTLE;
+    ifp->recovery_next = now + RECOVERY_SETTLE_TIME;
+    break;
+  case RECOVERY_SETTLE:
+    if (read_macaddr(ifp) != DP_OK) {
+      retry_recovery(ifp, now);
+      break;
+    }
+    ifp->stats.recoveries++;
+    ifp->stats.recovery_last = now - ifp->recovery_start;
+    ifp->stats.recovery_total += ifp->stats.recovery_last;
+    ifp->recovery = RECOVERY_NONE;
+    DPRINTF("recovered\r\n");
+    break;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Receiver control
+//----------------------------------------------------------------------------
+
+// 受信の有効/無効をプロトコルの登録状況に合わせる (SCSI バスの使用権を得た状態で呼ぶ)
+static void apply_receiver(struct ifdata *ifp)
+{
+  bool enable = (ifp->nproto > 0);
+  dp_status_t status = dp_enable_nowait(ifp->target, enable);
+  if (status != DP_OK) {
+    start_recovery(ifp, status);
+    return;
+  }
+  ifp->rxenabled = enable;
+  DPRINTF("%s receiver\r\n", enable ? "enable" : "disable");
+}
+
+// プロトコルの登録状況が変わった
+// SCSI バスが使用中ならポーリング割り込みで反映する
+static void update_receiver(struct ifdata *ifp)
+{
+  if (ifp->recovery != RECOVERY_NONE) {
+    return;     // エラー回復の中で反映される
+  }
+  if (bus_claim()) {
+    apply_receiver(ifp);
+    bus_release();
+  }
+}
+
+//----------------------------------------------------------------------------
+// Link status
+//----------------------------------------------------------------------------
+
+// リンク状態を確認する (SCSI バスの使用権を得た状態で呼ぶ)
+static void check_link(struct ifdata *ifp, uint32_t now)
+{
+  dp_status_t status = dp_wifi_info(ifp->target, &wifiinfo);
+  if (status != DP_OK) {
+    if (ifp->linkinfo == LINKINFO_UNKNOWN && status == DP_ERR_CHECK) {
+      // コマンドを受け付けない (リンク状態を返さない) デバイスなので常に接続中として扱う
+      ifp->linkinfo = LINKINFO_UNSUPPORTED;
+    } else {
+      // 通信エラーならエラー回復の後でまた確認する
+      start_recovery(ifp, status);
+    }
+    return;
+  }
+  ifp->linkinfo = LINKINFO_SUPPORTED;
+  ifp->stats.link_rssi = wifiinfo.rssi;
+
+  bool up = (wifiinfo.ssid[0] != '\0' && wifiinfo.rssi != 0);
+  if (up && !ifp->stats.link_up) {
+    // リンクが回復したので次の割り込みからすぐに受信を再開する
+    ifp->link_interval = LINK_CHECK_INTERVAL;
+    poll_retry = true;
+  } else if (!up && ifp->stats.link_up) {
+    ifp->stats.link_flaps++;
+    ifp->link_interval = LINK_CHECK_DOWN_MIN;
+  } else if (!up && ifp->link_interval < LINK_CHECK_DOWN_MAX) {
+    ifp->link_interval *= 2;
+  } else if (up) {
+    ifp->link_interval = LINK_CHECK_INTERVAL;
+  }
+  ifp->link_next = now + ifp->link_interval;
+
+#ifdef DEBUG_LINK_STATUS
+  if (up != ifp->stats.link_up) {
+    DPRINTF("link %s rssi=%d\r\n", up ? "up" : "down", wifiinfo.rssi);
+  }
+#endif
+  ifp->stats.link_up = up;
+}
+
+//----------------------------------------------------------------------------
+// Transmit queue
+//----------------------------------------------------------------------------
+
+// フレームの送信クラスを決める
+// 優先クラスは ARP と ICMP、ペイロードのない TCP セグメント (ACK や SYN) だけにする
+// (小さくてもデータを運ぶ UDP や TCP と、接続を閉じる FIN/RST は、同じ通信の大きなフレームを
+//  追い越さないように通常クラスにする)
+static int tx_class(const uint8_t *f, int len)
+{
+  const uint8_t *ip = f + ETH_HLEN;
+
+  if (len > TX_PRIO_LEN) {
+    return DYPT_TX_BULK;
+  }
+  switch (RD16(f + 12)) {
+  case ETH_TYPE_ARP:
+    return DYPT_TX_PRIO;
+  case ETH_TYPE_IP:
+  {
+    if (len < ETH_HLEN + 20 || ip[0] < 0x45 || ip[0] > 0x4f ||
+        (RD16(ip + 6) & 0x3fff) != 0) {   // フラグメントは扱わない
+      return DYPT_TX_BULK;
+    }
+    int hlen = (ip[0] & 0x0f) * 4;
+    if (ip[9] == IP_PROTO_ICMP) {
+      return DYPT_TX_PRIO;
+    }
+    if (ip[9] == IP_PROTO_TCP && len >= ETH_HLEN + hlen + 20 &&
+        RD16(ip + 2) == hlen + (ip[hlen + 12] >> 4) * 4 &&  // IP の長さ = IP ヘッダ + TCP ヘッダ
+        (ip[hlen + 13] & (TCP_FLAG_FIN | TCP_FLAG_RST)) == 0) {
+      return DYPT_TX_PRIO;
+    }
+    return DYPT_TX_BULK;
+  }
+  default:
+    return DYPT_TX_BULK;  // 知らないプロトコルは送信要求の順序を変えない
+  }
+}
+
+// フレームを入れる送信キューを選ぶ (どちらも一杯なら NULL)
+// 優先クラスのキューが一杯なら通常クラスのキューに入れる。その後の優先クラスのフレームが
+// 先に送られて順序が入れ替わらないよう、通常クラスに回したフレームを送り終えるまでは
+// 優先クラスのフレームも通常クラスのキューに入れる
+static struct txqueue *tx_select(struct ifdata *ifp, const uint8_t *f, int len)
+{
+  struct txqueue *q = &ifp->txq[DYPT_TX_PRIO];
+
+  if (tx_class(f, len) == DYPT_TX_PRIO && ifp->tx_bulk_fence == 0 && q->count < q->depth) {
+    return q;
+  }
+  q = &ifp->txq[DYPT_TX_BULK];
+  if (q->count < q->depth) {
+    return q;
+  }
+  return NULL;
+}
+
+// 先頭のフレームを送信できるかどうか
+static bool tx_ready(struct txqueue *q)
+{
+  return q->count > 0 && TXSLOT(q, q->head)->len != 0;
+}
+
+// 次に送信するキューを選ぶ
+// 優先クラスを先に送るが、通常クラスを待たせたまま TX_PRIO_BURST 個続けたら通常クラスを1つ送る
+static struct txqueue *tx_schedule(struct ifdata *ifp)
+{
+  struct txqueue *prio = &ifp->txq[DYPT_TX_PRIO];
+  struct txqueue *bulk = &ifp->txq[DYPT_TX_BULK];
+  bool bulk_ready = tx_ready(bulk);
+
+  if (tx_ready(prio)) {
+    if (!bulk_ready) {
+      ifp->tx_prio_run = 0;
+      return prio;
+    }
+    if (ifp->tx_prio_run < TX_PRIO_BURST) {
+      ifp->tx_prio_run++;
+      return prio;
+    }
+    ifp->stats.tx_bulk_forced++;
+  }
+  ifp->tx_prio_run = 0;
+  return bulk_ready ? bulk : NULL;
+}
+
+// 送信キューのフレームを送信する (SCSI バスの使用権を得た状態で呼ぶ)
+static void tx_flush(struct ifdata *ifp)
+{
+  uint16_t sr;
+  struct txqueue *q;
+
+  while ((q = tx_schedule(ifp)) != NULL) {
+    struct txslot *s = TXSLOT(q, q->head);
+    uint32_t t1 = dp_timestamp();
+    sr = dp_irq_lower(DP_XFER_IPL);
+    dp_status_t status = dp_send(s->len, ifp->target, s->frame);
+    dp_irq_enable(sr);
+    if (status != DP_OK) {
+      DPRINTF("send error %d\r\n", status);
+      start_recovery(ifp, status);
+      return;
+    }
+    hist_add(&ifp->latency.tx_queue_wait[q - ifp->txq], dp_elapsed(s->queued, t1));
+    hist_add(&ifp->latency.tx_xfer, dp_elapsed(t1, dp_timestamp()));
+    ifp->sentpacket = true;
+    ifp->stats.tx_frames++;
+    if (q == &ifp->txq[DYPT_TX_PRIO]) {
+      ifp->stats.tx_prio_frames++;
+    }
+
+    sr = dp_irq_disable();
+    s->len = 0;
+    if (++q->head == q->depth) {
+      q->head = 0;
+    }
+    q->count--;
+    if (q == &ifp->txq[DYPT_TX_BULK] && ifp->tx_bulk_fence > 0) {
+      ifp->tx_bulk_fence--;
+    }
+    dp_irq_enable(sr);
+  }
+}
+
+// フレームを送信キューに入れ、SCSI バスが空いていればすぐに送信する
+// SCSI バスが使用中なら次のポーリング割り込みで送信する
+static bool tx_submit(struct ifdata *ifp, const uint8_t *f, int len)
+{
+  uint16_t sr;
+  struct txqueue *q;
+  int tail;
+
+  // スロットの確保だけを割り込み禁止で行い、コピーは割り込みを許可したまま行う
+  sr = dp_irq_disable();
+  q = tx_select(ifp, f, len);
+  if (q == NULL) {
+    dp_irq_enable(sr);
+    ifp->stats.tx_queue_full++;
+    return false;
+  }
+  tail = q->head + q->count++;
+  if (q == &ifp->txq[DYPT_TX_BULK] && tx_class(f, len) == DYPT_TX_PRIO) {
+    ifp->tx_bulk_fence = q->count;  // このフレームを送り終えるまで優先キューを使わない
+  }
+  dp_irq_enable(sr);
+  if (tail >= q->depth) {
+    tail -= q->depth;
+  }
+
+  struct txslot *s = TXSLOT(q, tail);
+  memcpy(s->frame, f, len);
+  s->queued = dp_timestamp();
+  s->len = len;
+  poll_active = true;
+
+  if (bus_claim()) {
+    tx_flush(ifp);
+    bus_release();
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Protocol handler
+//----------------------------------------------------------------------------
+
+static rcvhandler_t find_proto_handler(struct ifdata *ifp, int proto)
+{
+  for (int i = 0; i < N_PROTO_HANDLER; i++) {
+    if (ifp->proto_handler[i].proto == proto) {
+      return ifp->proto_handler[i].func;
+    }
+  }
+  return NULL;
+}
+
+static int add_proto_handler(struct ifdata *ifp, int proto, rcvhandler_t func)
+{
+  for (int i = 0; i < N_PROTO_HANDLER; i++) {
+    if (ifp->proto_handler[i].proto == proto) {
+      return -1;    // already registered
+    }
+  }
+  for (int i = 0; i < N_PROTO_HANDLER; i++) {
+    if (ifp->proto_handler[i].proto == 0) {
+      ifp->proto_handler[i].proto = proto;
+      ifp->proto_handler[i].func = func;
+      ifp->nproto++;
+      return (ifp->nproto == 1) ? 1 : 0;
+    }
+  }
+  return -1;    // no space
+}
+
+static int delete_proto_handler(struct ifdata *ifp, int proto)
+{
+  for (int i = 0; i < N_PROTO_HANDLER; i++) {
+    if (ifp->proto_handler[i].proto == proto) {
+      ifp->proto_handler[i].proto = 0;
+      ifp->proto_handler[i].func = NULL;
+      ifp->nproto--;
+      return (ifp->nproto == 0) ? 1 : 0;
+    }
+  }
+  return -1;    // not found
+}
+
+//----------------------------------------------------------------------------
+// ARP / ICMP echo offload
+//----------------------------------------------------------------------------
+
+// 送信するフレームからインターフェースの IP アドレスを覚える
+static void learn_ipaddr(struct ifdata *ifp, const uint8_t *f, int len)
+{
+  const uint8_t *ip;
+
+  if (len >= ETH_HLEN + 28 && RD16(f + 12) == ETH_TYPE_ARP) {
+    ip = f + ETH_HLEN + 14;     // ARP sender protocol address
+  } else if (len >= ETH_HLEN + 20 && RD16(f + 12) == ETH_TYPE_IP) {
+    ip = f + ETH_HLEN + 12;     // IPv4 source address
+  } else {
+    return;
+  }
+  if (RD16(ip) == 0 && RD16(ip + 2) == 0) {
+    return;     // 0.0.0.0 (DHCP や ARP probe) は無視する
+  }
+  memcpy(ifp->ipaddr, ip, 4);
+  ifp->ipvalid = true;
+}
+
+static uint16_t ip_checksum(const uint8_t *p, int len)
+{
+  uint32_t sum = 0;
+  for (; len > 1; len -= 2, p += 2) {
+    sum += RD16(p);
+  }
+  if (len > 0) {
+    sum += *p << 8;
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+// 受信スロット上で作った応答フレームを送信キューに入れる
+static void offload_send(struct ifdata *ifp, uint8_t *f, int len)
+{
+  if (len < ETH_ZLEN) {
+    memset(f + len, 0, ETH_ZLEN - len);
+    len = ETH_ZLEN;
+  }
+  tx_submit(ifp, f, len);
+  ifp->stats.tx_offloaded++;
+}
+
+// 自分宛ての ARP 要求に応答する
+static bool offload_arp(struct ifdata *ifp, uint8_t *f, int len)
+{
+  uint8_t *arp = f + ETH_HLEN;
+
+  if (len < ETH_HLEN + 28 ||
+      RD16(arp + 0) != 1 ||             // hardware type: Ethernet
+      RD16(arp + 2) != ETH_TYPE_IP ||   // protocol type: IPv4
+      arp[4] != 6 || arp[5] != 4 ||
+      RD16(arp + 6) != 1 ||             // opcode: request
+      memcmp(arp + 24, ifp->ipaddr, 4) != 0) {
+    return false;
+  }
+  if (tx_select(ifp, f, ETH_ZLEN) == NULL) {
+    return false;   // 送信キューが一杯ならプロトコルスタックに任せる
+  }
+
+  memcpy(arp + 18, arp + 8, 10);        // target = sender
+  memcpy(arp + 8, ifp->macaddr, 6);     // sender = 自分
+  memcpy(arp + 14, ifp->ipaddr, 4);
+  RD16(arp + 6) = 2;                    // opcode: reply
+  memcpy(f + 0, arp + 18, 6);
+  memcpy(f + 6, ifp->macaddr, 6);
+
+  offload_send(ifp, f, ETH_HLEN + 28);
+  ifp->stats.rx_offloaded_arp++;
+  return true;
+}
+
+// 自分宛ての ICMP echo 要求に応答する
+static bool offload_icmp(struct ifdata *ifp, uint8_t *f, int len)
+{
+  uint8_t *ip = f + ETH_HLEN;
+  uint8_t ipbuf[4];
+
+  if (len < ETH_HLEN + 20 + 8 || ip[0] < 0x45 || ip[0] > 0x4f) {
+    return false;
+  }
+  int hlen = (ip[0] & 0x0f) * 4;
+  int iplen = RD16(ip + 2);
+  uint8_t *icmp = ip + hlen;
+
+  if (iplen < hlen + 8 || ETH_HLEN + iplen > len ||
+      (RD16(ip + 6) & 0x3fff) != 0 ||   // フラグメントは扱わない
+      ip[9] != 1 ||                     // protocol: ICMP
+      memcmp(ip + 16, ifp->ipaddr, 4) != 0 ||
+      icmp[0] != 8 || icmp[1] != 0) {   // echo request
+    return false;
+  }
+  if (tx_select(ifp, f, ETH_HLEN + iplen) == NULL) {
+    return false;   // 送信キューが一杯ならプロトコルスタックに任せる
+  }
+
+  // ICMP は type を 8 から 0 に変えるだけなのでチェックサムを差分で更新する
+  icmp[0] = 0;
+  uint32_t sum = (uint16_t)~RD16(icmp + 2) + (uint16_t)~0x0800;
+  sum = (sum & 0xffff) + (sum >> 16);
+  RD16(icmp + 2) = ~sum;
+
+  memcpy(ipbuf, ip + 12, 4);
+  memcpy(ip + 12, ip + 16, 4);
+  memcpy(ip + 16, ipbuf, 4);
+  ip[8] = 64;                           // TTL
+  RD16(ip + 10) = 0;
+  RD16(ip + 10) = ip_checksum(ip, hlen);
+
+  memcpy(f + 0, f + 6, 6);
+  memcpy(f + 6, ifp->macaddr, 6);
+
+  offload_send(ifp, f, ETH_HLEN + iplen);
+  ifp->stats.rx_offloaded_icmp++;
+  return true;
+}
+
+// ドライバ内で処理できるフレームなら応答して true を返す
+static bool offload_frame(struct ifdata *ifp, uint8_t *f, int len)
+{
+  if (!regp->offload || !ifp->ipvalid || !ifp->macvalid) {
+    return false;
+  }
+  switch (RD16(f + 12)) {
+  case ETH_TYPE_ARP:
+    return offload_arp(ifp, f, len);
+  case ETH_TYPE_IP:
+    return offload_icmp(ifp, f, len);
+  default:
+    return false;
+  }
+}
+
+//****************************************************************************
+// Ether driver command handler
+//****************************************************************************
+
+int etherfunc(int unit, int cmd, void *args)
+{
+  struct ifdata *ifp = &regp->ifs[unit];
+  DPRINTF("etherfunc:%d %d %p\r\n", unit, cmd, args);
+
+  switch (cmd) {
+  // command -1: Get trap number
+  case -1:
+    return ifp->trapno;
+
+  // command 0: Get driver version
+  case 0:
+    return 0x100;
+
+  // command 1: Get MAC addr
+  // command 2: Get PROM addr
+  case 1:
+  case 2:
+    if (ifp->recovery != RECOVERY_NONE) {
+      return -1;
+    }
+    if (!ifp->macvalid) {
+      if (!bus_claim()) {
+        return -1;
+      }
+      dp_status_t status = read_macaddr(ifp);
+      bus_release();
+      if (status != DP_OK) {
+        DPRINTF("stat error %d\r\n", status);
+        start_recovery(ifp, status);
+        return -1;
+      }
+    }
+    memcpy(args, ifp->macaddr, 6);
+    return (int)args;
+
+  // command 3: Set MAC addr
+  case 3:
+    return 0;
+
+  // command 4: Send ether packet
+  case 4:
+  {
+    struct {
+      int size;
+      uint8_t *buf;
+    } *sendpkt = args;
+    if (ifp->recovery != RECOVERY_NONE) {
+      return -1;    // エラー回復中は送信しない
+    }
+    if (!ifp->stats.link_up) {
+      ifp->stats.tx_linkdown++;
+      return -1;    // リンク切断中は送信しない
+    }
+    int len = sendpkt->size;
+    if (len <= 0 || len > regp->mtu + ETH_HLEN) {
+      return -1;
+    }
+    if (regp->offload) {
+      learn_ipaddr(ifp, sendpkt->buf, len);
+    }
+    return tx_submit(ifp, sendpkt->buf, len) ? 0 : -1;
+  }
+
+  // command 5: Set int addr
+  case 5:
+  {
+    struct {
+      int proto;
+      void (*handler)(int, uint8_t *, uint32_t);
+    } *setint = args;
+
+    int res = add_proto_handler(ifp, setint->proto, setint->handler);
+    DPRINTF("proto=0x%x handler=%p res=%d\r\n", setint->proto, setint->handler, res);
+    if (res > 0) {
+      update_receiver(ifp);
+      update_poll_active();
+    }
+    return 0;
+  }
+
+  // command 6: Get int addr
+  case 6:
+  {
+    int proto = (int)args;
+    return (int)find_proto_handler(ifp, proto);
+  }
+
+  // command 7: Delete int addr
+  case 7:
+  {
+    int proto = (int)args;
+    int res = delete_proto_handler(ifp, proto);
+    DPRINTF("proto=0x%x res=%d\r\n", proto, res);
+    if (res > 0) {
+      update_receiver(ifp);
+      update_poll_active();
+    }
+    return 0;   // not supported yet
+  }
+
+  // command 8: Set multicast addr
+  case 8:
+    return 0;   // not supported yet
+
+  // command 9: Get statistics
+  case 9:
+    return 0;   // not supported yet
+
+  // command 0x100: Get driver statistics (dyptether extension)
+  case DYPT_CMD_GET_STATS:
+    return (int)&ifp->stats;
+
+  // command 0x101: Set IP addr for offload (dyptether extension)
+  case DYPT_CMD_SET_IPADDR:
+    if (args == NULL) {
+      ifp->ipvalid = false;
+    } else {
+      memcpy(ifp->ipaddr, args, 4);
+      ifp->ipvalid = true;
+    }
+    return 0;
+
+  // command 0x102: Set/Get fault injection (dyptether extension)
+  case DYPT_CMD_FAULT:
+#ifdef DP_FAULT_INJECT
+    if (args != NULL) {
+      dp_fault_setup(args);
+    }
+    return (int)&dp_fault;
+#else
+    return -1;  // 故障注入なしでビルドされている
+#endif
+
+  // command 0x103: Get latency histograms (dyptether extension)
+  case DYPT_CMD_GET_LATENCY:
+    return (int)&ifp->latency;
+
+  default:
+    return -1;
+  }
+}
+
+//****************************************************************************
+// Packet polling interrupt handler
+//****************************************************************************
+
+static inline void update_max(uint32_t *max, uint32_t val)
+{
+  if (*max < val) {
+    *max = val;
+  }
+}
+
+// 1フレームを受信スロットに読み込む (SCSI バスの使用権を得た状態で呼び、使用権を解放して戻る)
+// 配送しないフレームはスロットの長さを 0 にしておく
+// 戻り値: デバイスに受信済みのフレームが残っていれば true
+static bool recv_frame(struct ifdata *ifp, uint8_t *slot)
+{
+  uint16_t sr;
+  uint32_t t1, t2;
+
+  // SCSI 転送中は SCC や MFP の割り込みを受け付ける
+  t1 = dp_timestamp();
+  sr = dp_irq_lower(DP_XFER_IPL);
+  dp_status_t status = regp->fixedrecv ?
+    dp_recv(regp->rxwindow, ifp->target, slot) :
+    dp_recv_sized(regp->rxwindow, ifp->target, slot);
+  bus_release();
+  dp_irq_enable(sr);
+  t2 = dp_timestamp();
+  update_max(&ifp->stats.recv_xfer_max, dp_elapsed(t1, t2));
+  ifp->stats.bus_hold_time += dp_elapsed(t1, t2);
+  uint32_t poll_wait = dp_elapsed(ifp->last_poll, t1);
+  ifp->last_poll = t2;
+
+  if (status != DP_OK)
+  {
+    RD16(slot) = 0;
+    start_recovery(ifp, status);
+    return false;
+  }
+
+  int len = dp_recv_length(slot);
+  bool more = dp_recv_more(slot);
+
+  if (len + DP_RECV_HEADER_SIZE > regp->rxwindow)
+  {
+    // 受信ウィンドウに収まらなかったフレームは破棄する
+    ifp->stats.rx_oversize++;
+    RD16(slot) = 0;
+    return false;
+  }
+
+  if (len >= ETH_HLEN + ETH_FCS_LEN)
+  {
+    ifp->stats.rx_frames++;
+    hist_add(&ifp->latency.rx_poll_wait, poll_wait);
+    hist_add(&ifp->latency.rx_xfer, dp_elapsed(t1, t2));
+  }
+  else
+  {
+    RD16(slot) = 0;
+  }
+
+  return more;
+}
+
+// プロトコルハンドラを呼び出す (割り込み種別に合わせて組み込み時に選ぶ)
+// 割り込みでポーリングしている時は、割り込み処理の中なのでそのまま呼び出す
+static void call_handler_irq(rcvhandler_t func, int len, uint8_t *f, uint32_t flag)
+{
+  func(len, f, flag);
+}
+
+// スレッドでポーリングしている時は、割り込みでポーリングする時と同じ条件で呼び出すため、
+// 割り込みマスクを MFP のレベルに上げる (プロセス切り替えの Timer-D や、他の割り込みから
+// TCP/IP ドライバが呼ばれる経路はこれで止まる。受信そのものは割り込みを許可したまま行う)
+static void call_handler_thread(rcvhandler_t func, int len, uint8_t *f, uint32_t flag)
+{
+  uint16_t sr = dp_irq_raise(MFP_IPL);
+  func(len, f, flag);
+  dp_irq_enable(sr);
+}
+
+static void (*call_handler)(rcvhandler_t func, int len, uint8_t *f, uint32_t flag) = call_handler_irq;
+
+// 受信スロットのフレームをプロトコルスタックに渡す
+static void deliver_frames(struct ifdata *ifp, int n)
+{
+  for (int i = 0; i < n; i++) {
+    uint8_t *slot = RXSLOT(ifp, i);
+    uint8_t *f = slot + DP_RECV_HEADER_SIZE;
+    int len = RD16(slot) - ETH_FCS_LEN;
+    if (len < ETH_HLEN) {
+      continue;
+    }
+
+    rcvhandler_t func = find_proto_handler(ifp, RD16(f + 12));
+    if (offload_frame(ifp, f, len)) {
+      // ドライバ内で応答した
+    } else if (func) {
+      uint32_t t = dp_timestamp();
+      call_handler(func, len, f, *(uint32_t *)ifp->ifname);
+      ifp->stats.rx_delivered++;
+      hist_add(&ifp->latency.rx_handler, dp_elapsed(t, dp_timestamp()));
+    } else {
+      ifp->stats.rx_unhandled++;
+    }
+  }
+}
+
+// 1つのインターフェースをポーリングする
+static void poll_iface(struct ifdata *ifp, bool retry)
+{
+  uint16_t sr;
+  uint32_t t0, t1;
+
+  // 受信するプロトコルがなく、デバイスの受信も停止済みなら何もしない
+  if (ifp->nproto == 0 && !ifp->rxenabled && ifp->recovery == RECOVERY_NONE &&
+      !tx_pending(ifp)) {
+    return;
+  }
+
+  // ディスクアクセス中ならポーリングを見送り、次の割り込みで優先して再試行する
+  if (dp_is_in_iocs()) {
+    ifp->stats.poll_deferred++;
+    poll_retry = true;
+    return;
+  }
+
+  // 割り込みを禁止するのは SCSI バスの使用権を得る間だけにする
+  t0 = dp_timestamp();
+  if (!bus_claim()) {
+    ifp->stats.poll_deferred++;
+    poll_retry = true;
+    return;
+  }
+  t1 = dp_timestamp();
+  update_max(&ifp->stats.irq_masked_max, dp_elapsed(t0, t1));
+
+  if (retry) {
+    ifp->stats.poll_retried++;
+  }
+
+  if (ifp->recovery != RECOVERY_NONE)
+  {
+    sr = dp_irq_lower(DP_XFER_IPL);
+    step_recovery(ifp);
+    bus_release();
+    dp_irq_enable(sr);
+    return;
+  }
+
+  if (ifp->rxenabled != (ifp->nproto > 0))
+  {
+    sr = dp_irq_lower(DP_XFER_IPL);
+    apply_receiver(ifp);
+    bus_release();
+    dp_irq_enable(sr);
+    return;
+  }
+
+  // 低頻度でリンク状態を確認し、切断中は受信のポーリングを止める
+  if (ifp->linkinfo != LINKINFO_UNSUPPORTED)
+  {
+    uint32_t now = dp_ontime();
+    if ((int32_t)(now - ifp->link_next) >= 0)
+    {
+      sr = dp_irq_lower(DP_XFER_IPL);
+      check_link(ifp, now);
+      bus_release();
+      dp_irq_enable(sr);
+      return;
+    }
+  }
+  if (!ifp->stats.link_up)
+  {
+    bus_release();
+    return;
+  }
+
+  // 送信キューに残っているフレームを先に送信する
+  if (tx_pending(ifp))
+  {
+    tx_flush(ifp);
+    if (ifp->recovery != RECOVERY_NONE)
+    {
+      bus_release();
+      return;
+    }
+  }
+
+  // 割り当て時間の範囲内で、デバイスに溜まっているフレームを受信する
+  // 受信スロットが一杯になるか受信を終えたら、SCSI バスを解放した状態でまとめて配送する
+  int n = 0;
+  for (;;)
+  {
+    bool more = recv_frame(ifp, RXSLOT(ifp, n++));
+    if (n == regp->rxslots) {
+      deliver_frames(ifp, n);
+      n = 0;
+    }
+    if (!more) {
+      break;
+    }
+    if (dp_elapsed(t1, dp_timestamp()) >= regp->budget) {
+      // 時間切れなのでディスクアクセスにバスを譲り、残りは次の割り込みで受信する
+      ifp->stats.budget_exhausted++;
+      poll_retry = true;
+      break;
+    }
+    if (dp_is_in_iocs() || !bus_claim()) {
+      ifp->stats.poll_deferred++;
+      poll_retry = true;
+      break;
+    }
+  }
+  deliver_frames(ifp, n);
+}
+
+// 全てのインターフェースを1回の割り込みでポーリングする
+void inthandler(void)
+{
+  bool retry = poll_retry;
+  poll_retry = false;
+
+  // 割り込みの入り口で見送った分はインターフェースを決める前なので en0 にだけ数える
+  regp->ifs[0].stats.poll_deferred += poll_deferred_fast;
+  poll_deferred_fast = 0;
+
+  for (int i = 0; i < regp->nif; i++) {
+    poll_iface(&regp->ifs[i], retry);
+  }
+
+  update_poll_active();
+}
+
+// インターフェースが1つの時のポーリング (ループを省く)
+static void inthandler_single(void)
+{
+  bool retry = poll_retry;
+  poll_retry = false;
+
+  regp->ifs[0].stats.poll_deferred += poll_deferred_fast;
+  poll_deferred_fast = 0;
+
+  poll_iface(&regp->ifs[0], retry);
+
+  update_poll_active();
+}
+
+// 割り込みの入り口とスレッドから呼ぶポーリング処理 (組み込み時に選ぶ)
+void (*poll_dispatch)(void) = inthandler;
+
+// ポーリングスレッド (/i3)
+// 割り込みを許可したまま受信し、プロトコルハンドラもスレッドの中で呼び出す
+static void poll_thread(void)
+{
+  while (!regp->thread_exit) {
+    if (!poll_active) {
+      _dos_sleep_pr(THREAD_IDLE_MS);
+      continue;
+    }
+    poll_dispatch();
+    if (poll_retry) {
+      _dos_change_pr();     // 見送ったポーリングは次のタイムスライスで再試行する
+    } else {
+      _dos_sleep_pr(irq_count_ini * 10);
+    }
+  }
+  regp->thread_running = false;
+  _dos_kill_pr();
+}
+
+//****************************************************************************
+// Device driver initialization
+//****************************************************************************
+
+// ネットワークインターフェースごとのデータを初期化する
+static void init_ifdata(void)
+{
+  for (int i = 0; i < N_IFACE; i++) {
+    struct ifdata *ifp = &regp->ifs[i];
+    memcpy(ifp->ifname, "en0", 4);
+    ifp->ifname[2] += i;
+    ifp->trapno = -1;
+    ifp->target = -1;
+    ifp->stats.link_up = true;
+  }
+  regp->ifs[0].trapno = 0;
+}
+
+// 見つかった DaynaPORT デバイスを使えるようにする
+static int init_iface(struct ifdata *ifp)
+{
+  if (dp_enable(ifp->target, true) != DP_OK)
+  {
+    _dos_print("DaynaPORT デバイスを初期化できませんでした\r\n");
+    return -1;
+  }
+
+  // MAC アドレスは初期化時に一度だけ読み出しておく
+  invalidate_macaddr(ifp);
+  if (read_macaddr(ifp) != DP_OK)
+  {
+    dp_enable(ifp->target, false);
+    _dos_print("DaynaPORT デバイスの MAC アドレスを取得できませんでした\r\n");
+    return -1;
+  }
+
+  // プロトコルが登録されるまでは受信を停止しておく
+  dp_enable_nowait(ifp->target, false);
+  ifp->rxenabled = false;
+  ifp->last_poll = dp_timestamp();
+
+  return 0;
+}
+
+static void print_iface(int unit)
+{
+  struct ifdata *ifp = &regp->ifs[unit];
+
+  if (dp_inquiry(ifp->target, &inquiry) == DP_OK)
+  {
+    _dos_print("DaynaPORT が利用可能です\r\n");
+    _dos_print("  INTERFACE: ");
+    _dos_print(ifp->ifname);
+    _dos_print("\r\n");
+    _dos_print("  SCSI ID  : ");
+    _dos_putchar("01234567"[ifp->target & 0x07]);
+    _dos_print("\r\n");
+
+    {
+      char vendor[sizeof(inquiry.vendor) + 1];
+      memcpy(vendor, inquiry.vendor, sizeof(inquiry.vendor));
+      vendor[sizeof(inquiry.vendor)] = '\0';
+      _dos_print("  VENDOR   : ");
+      _dos_print(vendor);
+      _dos_print("\r\n");
+    }
+    {
+      char product[sizeof(inquiry.product) + 1];
+      memcpy(product, inquiry.product, sizeof(inquiry.product));
+      product[sizeof(inquiry.product)] = '\0';
+      _dos_print("  PRODUCT  : ");
+      _dos_print(product);
+      _dos_print("\r\n");
+    }
+    {
+      uint8_t mac[6];
+      etherfunc(unit, 1, mac);
+      _dos_print("  MAC ADDR : ");
+      for (int i = 0; i < 6; i++)
+      {
+        _dos_putchar("0123456789abcdef"[mac[i] >> 4]);
+        _dos_putchar("0123456789abcdef"[mac[i] & 0xf]);
+        if (i < 5)
+        {
+          _dos_putchar(':');
+        }
+      }
+      _dos_print("\r\n");
+    }
+  }
+}
+
+static void print_dec(uint32_t val)
 {
-  unsigned long val = 0;
-  while (1) {
-    char c = tolower(*p++);
-    if (c >= '0' && c <= '9') {
-      val = val * 16 + c - '0';
-    } else if (c >= 'a' && c <= 'f') {
-      val = val * 16 + c - 'a' + 10;
-    } else {
-      break;
+  char buf[11];
+  char *p = &buf[sizeof(buf) - 1];
+
+  *p = '\0';
+  do {
+    *--p = '0' + val % 10;
+    val /= 10;
+  } while (val != 0);
+  _dos_print(p);
+}
+
+// 受信スロットと送信キューを base (常駐部分の後ろ) から並べ、常駐部分の終わりを決める
+static int alloc_buffers(uint8_t *base)
+{
+  uint8_t *p = (uint8_t *)SLOT_ALIGN((uintptr_t)base);
+
+  regp->rxwindow = DP_RECV_HEADER_SIZE + regp->mtu + ETH_HLEN + ETH_FCS_LEN;
+  regp->rxslot_size = SLOT_ALIGN(regp->rxwindow);
+  regp->txslot_size = SLOT_ALIGN(offsetof(struct txslot, frame) + regp->mtu + ETH_HLEN);
+
+  for (int i = 0; i < regp->nif; i++) {
+    struct ifdata *ifp = &regp->ifs[i];
+    ifp->rxbuf = p;
+    p += regp->rxslots * regp->rxslot_size;
+    ifp->txq[DYPT_TX_PRIO].slot_size = TX_PRIO_SLOT_SIZE;
+    ifp->txq[DYPT_TX_PRIO].depth = TX_PRIO_DEPTH;
+    ifp->txq[DYPT_TX_BULK].slot_size = regp->txslot_size;
+    ifp->txq[DYPT_TX_BULK].depth = regp->txdepth;
+    for (int c = 0; c < DYPT_TX_CLASSES; c++) {
+      struct txqueue *q = &ifp->txq[c];
+      q->buf = p;
+      p += q->depth * q->slot_size;
     }
   }
-  if (endp) {
-    *endp = (char *)p - 1;
+  if (regp->irqtype == IRQ_THREAD) {
+    regp->thread_stack = p;
+    p += THREAD_USTACK_SIZE + THREAD_STACK_SIZE;
   }
-  return val;
+  if (memlimit != NULL && p > memlimit) {
+    return -1;
+  }
+  regp->bufend = p;
+
+  // 配置がメモリブロックに収まることを確かめてから送信キューをクリアする
+  for (int i = 0; i < regp->nif; i++) {
+    struct ifdata *ifp = &regp->ifs[i];
+    for (int c = 0; c < DYPT_TX_CLASSES; c++) {
+      struct txqueue *q = &ifp->txq[c];
+      memset(q->buf, 0, q->depth * q->slot_size);
+    }
+  }
+  return 0;
 }
 
-//----------------------------------------------------------------------------
-// Protocol handler
-//----------------------------------------------------------------------------
-
-static rcvhandler_t find_proto_handler(int proto)
+// 受信を停止した状態で dp_stat と空の受信に要する時間を計測する
+static int measure_scsi(struct ifdata *ifp)
 {
-  for (int i = 0; i < N_PROTO_HANDLER; i++) {
-    if (proto_handler[i].proto == proto) {
-      return proto_handler[i].func;
+  for (int i = 0; i < CAL_SAMPLES; i++) {
+    uint32_t t0 = dp_timestamp();
+    if (dp_stat(sizeof(statdata), ifp->target, &statdata) != DP_OK) {
+      return -1;
     }
+    uint32_t t1 = dp_timestamp();
+    dp_status_t status = regp->fixedrecv ?
+      dp_recv(regp->rxwindow, ifp->target, RXSLOT(ifp, 0)) :
+      dp_recv_sized(regp->rxwindow, ifp->target, RXSLOT(ifp, 0));
+    if (status != DP_OK) {
+      return -1;
+    }
+    uint32_t t2 = dp_timestamp();
+    cal.stat_cost += dp_elapsed(t0, t1);
+    cal.recv_cost += dp_elapsed(t1, t2);
   }
-  return NULL;
+  return 0;
 }
 
-static int add_proto_handler(int proto, rcvhandler_t func)
+// 垂直同期信号の立ち上がりを待つ (時間内に変化しなければ false)
+static bool wait_vdisp_edge(void)
 {
-  for (int i = 0; i < N_PROTO_HANDLER; i++) {
-    if (proto_handler[i].proto == proto) {
-      return -1;    // already registered
+  uint32_t t0 = dp_timestamp();
+  while (*mfp_gpip & MFP_GPIP_VDISP) {
+    if (dp_elapsed(t0, dp_timestamp()) >= CAL_EDGE_TIMEOUT) {
+      return false;
     }
   }
-  for (int i = 0; i < N_PROTO_HANDLER; i++) {
-    if (proto_handler[i].proto == 0) {
-      proto_handler[i].proto = proto;
-      proto_handler[i].func = func;
-      regp->nproto++;
-      return (regp->nproto == 1) ? 1 : 0;
+  while (!(*mfp_gpip & MFP_GPIP_VDISP)) {
+    if (dp_elapsed(t0, dp_timestamp()) >= CAL_EDGE_TIMEOUT) {
+      return false;
     }
   }
-  return -1;    // no space
+  return true;
 }
 
-static int delete_proto_handler(int proto)
+// 垂直同期 (V-DISP と Timer-A の割り込み) の周期を計測する
+static uint32_t measure_vdisp(void)
 {
-  for (int i = 0; i < N_PROTO_HANDLER; i++) {
-    if (proto_handler[i].proto == proto) {
-      proto_handler[i].proto = 0;
-      proto_handler[i].func = NULL;
-      regp->nproto--;
-      return (regp->nproto == 0) ? 1 : 0;
+  if (!wait_vdisp_edge()) {
+    return 0;
+  }
+  uint32_t t0 = dp_timestamp();
+  for (int i = 0; i < CAL_VDISP_FRAMES; i++) {
+    if (!wait_vdisp_edge()) {
+      return 0;
     }
   }
-  return -1;    // not found
+  return dp_elapsed(t0, dp_timestamp()) / CAL_VDISP_FRAMES;
 }
 
-//****************************************************************************
-// Ether driver command handler
-//****************************************************************************
-
-int etherfunc(int cmd, void *args)
+// 計測結果から、目標の受信遅延を CPU 時間の予算内で満たす割り込み種別とポーリング間隔を選ぶ
+// 満たすものが複数あれば CPU 時間の少ない (間隔の長い) もの、なければ予算内で最も間隔の短いものにする
+static int calibrate(void)
 {
-  int retry = false;
-  DPRINTF("etherfunc:%d %p\r\n", cmd, args);
-
-  if (setjmp(jenv) != 0) {
-    DPRINTF("etherfunc error\r\n");
-    retry = true;
-    inrecovery = true;
-    hotplug = false;
-  }
-
-  if (inrecovery) {
-    if (!retry && !hotplug) {
+  for (int i = 0; i < regp->nif; i++) {
+    if (measure_scsi(&regp->ifs[i]) < 0) {
       return -1;
     }
-
-    DPRINTF("error recovery\r\n");
-    inrecovery = false;
   }
+  cal.vdisp_period = measure_vdisp();
 
-  switch (cmd) {
-  // command -1: Get trap number
-  case -1:
-    return regp->trapno;
-
-  // command 0: Get driver version
-  case 0:
-    return 0x100;
-
-  // command 1: Get MAC addr
-  case 1:
-    dp_stat(6, regp->target, &dyptbuf[DYPTBUF_TEMP]);
-    memcpy(args, &dyptbuf[DYPTBUF_TEMP], 6);
-    return (int)args;
-
-  // command 2: Get PROM addr
-  case 2:
-    dp_stat(6, regp->target, &dyptbuf[DYPTBUF_TEMP]);
-    memcpy(args, &dyptbuf[DYPTBUF_TEMP], 6);
-    return (int)args;
-
-  // command 3: Set MAC addr
-  case 3:
-    return 0;
-
-  // command 4: Send ether packet
-  case 4:
-  {
-    struct {
-      int size;
-      uint8_t *buf;
-    } *sendpkt = args;
-    int len = sendpkt->size;
-    memcpy(&dyptbuf[DYPTBUF_SENDDATA], sendpkt->buf, sendpkt->size);
-    if (dp_send(len, regp->target, &dyptbuf[DYPTBUF_SENDDATA]) != 0)
-    {
-      DPRINTF("send error\r\n");
-      longjmp(jenv, -1);
-    }
-    sentpacket = true;
-    return 0;
+  // スレッドは割り込み種別を変えられないので (バッファ確保済み) ポーリング間隔だけを選ぶ
+  uint32_t period[IRQ_THREAD + 1] = { 0 };
+  if (regp->irqtype == IRQ_THREAD) {
+    period[IRQ_THREAD] = TIMERC_PERIOD;
+  } else {
+    period[IRQ_GPIO4] = cal.vdisp_period;
+    period[IRQ_TIMERA] = cal.vdisp_period;
+    period[IRQ_TIMERC] = TIMERC_PERIOD;
   }
 
-  // command 5: Set int addr
-  case 5:
-  {
-    struct {
-      int proto;
-      void (*handler)(int, uint8_t *, uint32_t);
-    } *setint = args;
-
-    int res = add_proto_handler(setint->proto, setint->handler);
-    DPRINTF("proto=0x%x handler=%p res=%d\r\n", setint->proto, setint->handler, res);
-    if (res > 0) {
-      DPRINTF("enable receiver\r\n");
+  int best_type = -1;
+  int best_count = 0;
+  uint32_t best = 0;
+  cal.met = false;
+  for (int type = 0; type <= IRQ_THREAD; type++) {
+    for (int count = 1; count <= 8 && period[type] != 0; count++) {
+      uint32_t interval = period[type] * count;
+      if (cal.recv_cost * 1000 > CAL_CPU_PERMIL * CAL_SAMPLES * interval) {
+        continue;
+      }
+      bool met = interval <= cal_target * 200;
+      if (met ? (!cal.met || interval > best) :
+                (!cal.met && (best_type < 0 || interval < best))) {
+        best_type = type;
+        best_count = count;
+        best = interval;
+        cal.met = met;
+      }
     }
-    return 0;
-  }
-
-  // command 6: Get int addr
-  case 6:
-  {
-    int proto = (int)args;
-    return (int)find_proto_handler(proto);
   }
-
-  // command 7: Delete int addr
-  case 7:
-  {
-    int proto = (int)args;
-    int res = delete_proto_handler(proto);
-    DPRINTF("proto=0x%x res=%d\r\n", proto, res);
-    if (res > 0) {
-      DPRINTF("disable receiver\r\n");
+  if (best_type < 0) {
+    // 予算内に収まらなければ最も間隔の長いものにする
+    for (int type = 0; type <= IRQ_THREAD; type++) {
+      if (period[type] * 8 > best) {
+        best_type = type;
+        best_count = 8;
+        best = period[type] * 8;
+      }
     }
-    return 0;   // not supported yet
   }
 
-  // command 8: Set multicast addr
-  case 8:
-    return 0;   // not supported yet
+  regp->irqtype = best_type;
+  irq_count_ini = best_count;
+  cal.interval = best;
+  return 0;
+}
 
-  // command 9: Get statistics
-  case 9:
-    return 0;   // not supported yet
+static void print_calibration(void)
+{
+  _dos_print("  CALIBRATE: STAT ");
+  print_dec(cal.stat_cost * 50 / CAL_SAMPLES);
+  _dos_print(" us, RECV ");
+  print_dec(cal.recv_cost * 50 / CAL_SAMPLES);
+  _dos_print(" us, V-DISP ");
+  if (cal.vdisp_period) {
+    print_dec(cal.vdisp_period * 50);
+    _dos_print(" us\r\n");
+  } else {
+    _dos_print("-\r\n");
+  }
 
-  default:
-    return -1;
+  uint32_t permil = cal.recv_cost * 1000 / (CAL_SAMPLES * cal.interval);
+  _dos_print("  POLLING  : ");
+  _dos_print(irqname[regp->irqtype]);
+  _dos_print(" x ");
+  print_dec(irq_count_ini);
+  _dos_print(" (");
+  print_dec(cal.interval / 20);
+  _dos_print(" ms, CPU ");
+  print_dec(permil / 10);
+  _dos_putchar('.');
+  _dos_putchar('0' + permil % 10);
+  _dos_print("%)");
+  if (!cal.met) {
+    _dos_print(" 目標の受信遅延 ");
+    print_dec(cal_target * 10);
+    _dos_print(" ms を満たせません");
   }
+  _dos_print("\r\n");
 }
 
-//****************************************************************************
-// Packet polling interrupt handler
-//****************************************************************************
-
-void inthandler(void)
+static int etherinit(void)
 {
-  uint16_t sr;
-  if (dp_is_in_iocs()) return;
-
-  sr = dp_irq_disable();
-  if (dp_is_free())
+  if (ntarget == 0)
   {
-    dp_recv(0x600, regp->target, &dyptbuf[DYPTBUF_RECV]);
-    dp_irq_enable(sr);
-    int len = (dyptbuf[DYPTBUF_RECV+0] << 8) | dyptbuf[DYPTBUF_RECV+1];
-
-    if (len >= 14 + 4)
+    // SCSI ID の指定がなければ 7~0 の順で DaynaPORT デバイスを探す
+    for (int target = 7; target >= 0 && regp->nif < N_IFACE; target--)
     {
-      int proto = *(uint16_t *)&dyptbuf[DYPTBUF_RECVDATA + 12];
-      rcvhandler_t func = find_proto_handler(proto);
-      if (func) {
-        func(len - 4, &dyptbuf[DYPTBUF_RECVDATA], *(uint32_t *)regp->ifname);
+      if (dp_inquiry(target, &inquiry) == DP_OK)
+      {
+        if (dp_is_daynaport(&inquiry))
+        {
+          /* DaynaPORTデバイスを見つけた */
+          regp->ifs[regp->nif++].target = target;
+        }
       }
     }
   }
   else
   {
-    dp_irq_enable(sr);
-  }
-}
-
-//****************************************************************************
-// Device driver initialization
-//****************************************************************************
-
-static int etherinit(void)
-{
-  static struct dp_inquiry_data inquiry;
-
-  // 空いているtrap番号を探す
-  regp->trapno = find_unused_trap(regp->trapno);
-  if (regp->trapno < 0) {
-    _dos_print("ネットワークインターフェースに使用するtrap番号が空いていません\r\n");
-    return -1;
-  }
-
-  // インターフェース名を設定する
-  memcpy(&devheader.name[5], regp->ifname, 3);
-
-  for (int target = 7; target >= 0; target--)
-  {
-    if (dp_inquiry(target, &inquiry) == 0)
+    for (int i = 0; i < ntarget; i++)
     {
-      if (dp_is_daynaport(&inquiry))
+      int target = regp->ifs[i].target;
+      if (dp_inquiry(target, &inquiry) != DP_OK || !dp_is_daynaport(&inquiry))
       {
-        /* DaynaPORTデバイスを見つけた */
-        regp->target = target;
-        break;
+        _dos_print("指定された SCSI ID に DaynaPORT デバイスがありません\r\n");
+        return -1;
       }
     }
+    regp->nif = ntarget;
   }
-  if (regp->target < 0)
+  if (regp->nif == 0)
   {
     _dos_print("DaynaPORT デバイスが見つかりません\r\n");
     return -1;
   }
 
-  if (dp_enable(regp->target, true) != 0)
-  {
-    _dos_print("DaynaPORT デバイスを初期化できませんでした\r\n");
+  // 送受信バッファをドライバの後ろに確保する
+  extern char _end;
+  if (alloc_buffers((uint8_t *)&_end) < 0) {
+    _dos_print("送受信バッファを確保するメモリが足りません\r\n");
     return -1;
   }
 
-  if (setjmp(jenv) != 0) {
-    dp_enable(regp->target, false);
-    _dos_print("デバイスエラーが発生しました\r\n");
-    return -1;
+  // 空いているtrap番号を探す
+  int used = 0;
+  for (int i = 0; i < regp->nif; i++) {
+    struct ifdata *ifp = &regp->ifs[i];
+    ifp->trapno = find_unused_trap(ifp->trapno, used);
+    if (ifp->trapno < 0) {
+      _dos_print("ネットワークインターフェースに使用するtrap番号が空いていません\r\n");
+      return -1;
+    }
+    used |= 1 << ifp->trapno;
+  }
+
+  for (int i = 0; i < regp->nif; i++) {
+    if (init_iface(&regp->ifs[i]) < 0) {
+      while (--i >= 0) {
+        dp_enable(regp->ifs[i].target, false);
+      }
+      return -1;
+    }
+  }
+
+  // 割り込み種別とポーリング間隔を自動調整する
+  if (cal_target > 0 && calibrate() < 0) {
+    _dos_print("自動調整の計測に失敗したため、指定された割り込み種別とポーリング間隔を使います\r\n");
+    cal_target = 0;
+  }
+
+  // インターフェース数と割り込み種別に合わせて、ポーリングと配送の経路を選ぶ
+  poll_dispatch = (regp->nif == 1) ? inthandler_single : inthandler;
+  call_handler = (regp->irqtype == IRQ_THREAD) ? call_handler_thread : call_handler_irq;
+
+  // ポーリングスレッドを起動する (プロトコルが登録されるまではスリープしている)
+  if (regp->irqtype == IRQ_THREAD) {
+    uint8_t *usp = regp->thread_stack + THREAD_USTACK_SIZE;
+    uint8_t *ssp = usp + THREAD_STACK_SIZE;
+    regp->thread_running = true;
+    if (_dos_open_pr("dyptether", THREAD_COUNTER, (int)usp, (int)ssp, 0x2000,
+                     (int)poll_thread, &thread_ctrl, 0) < 0) {
+      regp->thread_running = false;
+      for (int i = 0; i < regp->nif; i++) {
+        dp_enable(regp->ifs[i].target, false);
+      }
+      _dos_print("ポーリングスレッドを起動できません (CONFIG.SYS の PROCESS を確認してください)\r\n");
+      return -1;
+    }
+  }
+
+  // インターフェース名を設定して、デバイスヘッダをつなげる
+  for (int i = 0; i < regp->nif; i++) {
+    struct dos_dev_header *devh = devheader_table[i];
+    memcpy(&devh->name[5], regp->ifs[i].ifname, 3);
+    devh->next = (i + 1 < regp->nif) ? devheader_table[i + 1] : (struct dos_dev_header *)-1;
   }
 
   // 割り込みベクタを設定する
-  regp->oldtrap = _dos_intvcs(0x20 + regp->trapno, trap_entry);
+  for (int i = 0; i < regp->nif; i++) {
+    struct ifdata *ifp = &regp->ifs[i];
+    ifp->oldtrap = _dos_intvcs(0x20 + ifp->trapno, trap_entry_table[i]);
+  }
   irq_count = irq_count_ini;
   if (regp->irqtype == IRQ_GPIO4)
   {
@@ -490,7 +1832,7 @@ static int etherinit(void)
   }
   else if (regp->irqtype == IRQ_TIMERA)
   {
-    _iocs_vdispst(inthandler_timer_a_asm, 0, irq_count_ini);
+    _iocs_vdispst(inthandler_timer_a_asm, 0, 1);
   }
   else if (regp->irqtype == IRQ_TIMERC)
   {
@@ -505,44 +1847,30 @@ static int etherinit(void)
     dp_irq_enable(sr);
   }
 
-  if (dp_inquiry(regp->target, &inquiry) == 0)
-  {
-    _dos_print("DaynaPORT が利用可能です\r\n");
-    _dos_print("  SCSI ID  : ");
-    _dos_putchar("01234567"[regp->target & 0x07]);
-    _dos_print("\r\n");
+  update_poll_active();
 
-    {
-      char vendor[sizeof(inquiry.vendor) + 1];
-      memcpy(vendor, inquiry.vendor, sizeof(inquiry.vendor));
-      vendor[sizeof(inquiry.vendor)] = '\0';
-      _dos_print("  VENDOR   : ");
-      _dos_print(vendor);
-      _dos_print("\r\n");
-    }
-    {
-      char product[sizeof(inquiry.product) + 1];
-      memcpy(product, inquiry.product, sizeof(inquiry.product));
-      product[sizeof(inquiry.product)] = '\0';
-      _dos_print("  PRODUCT  : ");
-      _dos_print(product);
-      _dos_print("\r\n");
-    }
-    {
-      uint8_t mac[6];
-      etherfunc(1, mac);
-      _dos_print("  MAC ADDR : ");
-      for (int i = 0; i < 6; i++)
-      {
-        _dos_putchar("0123456789abcdef"[mac[i] >> 4]);
-        _dos_putchar("0123456789abcdef"[mac[i] & 0xf]);
-        if (i < 5)
-        {
-          _dos_putchar(':');
-        }
-      }
-      _dos_print("\r\n");
-    }
+  for (int i = 0; i < regp->nif; i++) {
+    print_iface(i);
+  }
+  _dos_print("  BUFFER   : MTU ");
+  print_dec(regp->mtu);
+  _dos_print(", RX ");
+  print_dec(regp->rxslots);
+  _dos_print(" x ");
+  print_dec(regp->rxslot_size);
+  _dos_print(", TX ");
+  print_dec(regp->txdepth);
+  _dos_print(" x ");
+  print_dec(regp->txslot_size);
+  _dos_print(" + ");
+  print_dec(TX_PRIO_DEPTH);
+  _dos_print(" x ");
+  print_dec(TX_PRIO_SLOT_SIZE);
+  _dos_print("\r\n  RESIDENT : ");
+  print_dec(regp->bufend - (uint8_t *)&devheader);
+  _dos_print(" bytes\r\n");
+  if (cal_target > 0) {
+    print_calibration();
   }
 
   return 0;
@@ -550,9 +1878,14 @@ static int etherinit(void)
 
 static void etherfini(void)
 {
-  if (regp->target > 0)
+  for (int i = 0; i < regp->nif; i++)
   {
-    dp_enable(regp->target, false);
+    struct ifdata *ifp = &regp->ifs[i];
+    if (ifp->target >= 0)
+    {
+      dp_enable(ifp->target, false);
+      invalidate_macaddr(ifp);
+    }
   }
 }
 
@@ -562,6 +1895,8 @@ static int parse_cmdline(char *p, int issys)
   _dos_print("X68000 DaynaPORT Ethernet driver version " GIT_REPO_VERSION "\r\n");
   char c;
 
+  init_ifdata();
+
   if (issys) {
     while (*p++ != '\0')  // デバイスドライバ名をスキップする
       ;
@@ -578,15 +1913,16 @@ static int parse_cmdline(char *p, int issys)
       switch (tolower(*p++)) {
       case 't':
         c = *p++;
-        if (c >= '0' && c <= '7') {
-          regp->trapno = c - '0';
+        if (c >= '0' && c <= '7' && ntrapno < N_IFACE) {
+          regp->ifs[ntrapno++].trapno = c - '0';
         } else {
           return -1;
         }
         break;
       case 'i':
         c = *p++;
-        if (c >= '0' && c <= '2') {
+        // スレッドは Human68k の起動後でないと作れないので CONFIG.SYS では使えない
+        if (c >= '0' && c <= (issys ? '2' : '3')) {
           regp->irqtype = c - '0';
         } else {
           return -1;
@@ -600,10 +1936,62 @@ static int parse_cmdline(char *p, int issys)
           return -1;
         }
         break;
+      case 'c':
+        c = *p;
+        if (c >= '1' && c <= '9') {
+          cal_target = c - '0';
+          p++;
+        } else {
+          cal_target = CAL_TARGET_DEFAULT;
+        }
+        break;
+      case 'b':
+        c = *p++;
+        if (c >= '0' && c <= '9') {
+          regp->budget = (c - '0') * 20;
+        } else {
+          return -1;
+        }
+        break;
       case 'd':
         c = *p++;
-        if (c >= '0' && c <= '7') {
-          regp->target = c - '0';
+        if (c >= '0' && c <= '7' && ntarget < N_IFACE) {
+          regp->ifs[ntarget++].target = c - '0';
+        } else {
+          return -1;
+        }
+        break;
+      case 'a':
+        regp->offload = true;
+        break;
+      case 'f':
+        regp->fixedrecv = true;
+        break;
+      case 'm':
+      {
+        int mtu = 0;
+        while (*p >= '0' && *p <= '9') {
+          mtu = mtu * 10 + (*p++ - '0');
+        }
+        if (mtu >= MTU_MIN && mtu <= MTU_MAX) {
+          regp->mtu = mtu;
+        } else {
+          return -1;
+        }
+        break;
+      }
+      case 's':
+        c = *p++;
+        if (c >= '1' && c <= '0' + SLOTS_MAX) {
+          regp->rxslots = c - '0';
+        } else {
+          return -1;
+        }
+        break;
+      case 'q':
+        c = *p++;
+        if (c >= '1' && c <= '0' + SLOTS_MAX) {
+          regp->txdepth = c - '0';
         } else {
           return -1;
         }
@@ -642,6 +2030,14 @@ int interrupt(void)
     return 0x700d;
   }
 
+  // 2つめ以降のデバイスヘッダの初期化は済んでいる
+  static int initialized = false;
+  if (initialized) {
+    req->addr = regp->bufend;
+    return 0;
+  }
+  initialized = true;
+
   _dos_print("\r\n");
 
   // パラメータを解析する
@@ -654,26 +2050,39 @@ int interrupt(void)
     return 0x700d;
   }
 
-  extern char _end;
-  req->addr = &_end;
+  req->addr = regp->bufend;
   return 0;
 }
 
-// Xファイル実行時
+#ifdef __m68k__
+// Xファイル実行時 (ホストでの soak テストのビルドでは使わない)
 void _start(void)
 {
   char *cmdl;
-  __asm__ volatile ("move.l %%a2,%0" : "=r"(cmdl)); // コマンドラインへのポインタ
+  uint8_t **memblk;
+  __asm__ volatile ("move.l %%a2,%0\n\tmove.l %%a0,%1"
+                    : "=d"(cmdl), "=d"(memblk));    // コマンドラインとメモリ管理ポインタ
+  memlimit = memblk[2];                             // このプロセスのメモリブロックの終わり
 
   if (parse_cmdline(cmdl, 0) < 0) {
     _dos_print(
       "Usage: dyptether [Options]\r\n"
       "Options:\r\n"
       "  -t<trapno>\tネットワークインターフェースに使用するtrap番号を指定する(0~7)\r\n"
+      "  \t\t(複数指定すると en0, en1 の順に割り当てる)\r\n"
       "  -d<scsiid>\tDaynaPORTのSCSI IDを指定する(0~7)(デフォルトは7~0の順で検索)\r\n"
+      "  \t\t(複数指定すると en0, en1 の順に割り当てる)\r\n"
       "  -i<type>\tポーリングに使用する割り込み種別の指定する\r\n"
-      "  \t\t(0:V-DISP(default),1:Timer-A,2:Timer-C)\r\n"
+      "  \t\t(0:V-DISP(default),1:Timer-A,2:Timer-C,3:スレッド)\r\n"
       "  -p<count>\tパケットの受信ポーリング間隔を指定する(1~8)(default:4)\r\n"
+      "  -b<time>\t1回のポーリングで受信に使う時間をms単位で指定する(0~9)(default:1)\r\n"
+      "  -c[<time>]\t割り込み種別とポーリング間隔を自動調整する\r\n"
+      "  \t\t(目標の受信遅延を10ms単位で指定する(1~9)(default:5))\r\n"
+      "  -a\t\tARP と ICMP echo 要求にドライバ内で応答する\r\n"
+      "  -f\t\t受信のたびに最大長のフレームを要求する\r\n"
+      "  -m<mtu>\tMTU を指定する(576~1500)\r\n"
+      "  -s<slots>\t1回のポーリングでまとめて配送するフレーム数を指定する(1~8)\r\n"
+      "  -q<depth>\t送信キューの長さを指定する(1~8)\r\n"
       "  -r\t\t常駐しているdyptetherドライバがあれば常駐解除する\r\n"
     );
     _dos_exit2(1);
@@ -699,16 +2108,36 @@ void _start(void)
       _dos_exit2(1);
     }
 
-    if (regp->nproto > 0) {
-      _dos_print("ネットワークインターフェースが使用中のため常駐解除できません\r\n");
-      _dos_exit2(1);
+    for (int i = 0; i < regp->nif; i++) {
+      if (regp->ifs[i].nproto > 0) {
+        _dos_print("ネットワークインターフェースが使用中のため常駐解除できません\r\n");
+        _dos_exit2(1);
+      }
+    }
+
+    // ポーリングスレッドの終了を待つ
+    if (regp->irqtype == IRQ_THREAD) {
+      uint32_t start = dp_ontime();
+      regp->thread_exit = true;
+      while (regp->thread_running && dp_ontime() - start < 200) {
+        _dos_change_pr();
+      }
+      if (regp->thread_running) {
+        regp->thread_exit = false;
+        _dos_print("ポーリングスレッドを停止できませんでした\r\n");
+        _dos_exit2(1);
+      }
     }
 
     // 動作中のドライバを停止する
     etherfini();
 
     // デバイスドライバのリンクを解除する
-    devh->next = olddev->next;
+    struct dos_dev_header *lastdev = olddev;
+    for (int i = 1; i < regp->nif; i++) {
+      lastdev = lastdev->next;
+    }
+    devh->next = lastdev->next;
 
     // 割り込みベクタを元に戻す
     if (regp->irqtype == IRQ_GPIO4)
@@ -732,7 +2161,9 @@ void _start(void)
       }
       dp_irq_enable(sr);
     }
-    _iocs_b_intvcs(0x20 + regp->trapno, regp->oldtrap);
+    for (int i = 0; i < regp->nif; i++) {
+      _iocs_b_intvcs(0x20 + regp->ifs[i].trapno, regp->ifs[i].oldtrap);
+    }
     _dos_mfree((void *)olddev - 0xf0);
 
     _dos_print("ドライバの常駐を解除しました\r\n");
@@ -758,7 +2189,7 @@ void _start(void)
   regp->removable = 1;
 
   // 常駐終了する
-  extern char _end;
-  int size = (int)&_end - (int)&devheader;
+  int size = (int)regp->bufend - (int)&devheader;
   _dos_keeppr(size, 0);
 }
+#endif
@@ -59,5 +59,64 @@ struct dos_dev_header {
 // Private structure definitions
 //****************************************************************************
 
+// dyptether 独自の拡張コマンド
+#define DYPT_CMD_GET_STATS  0x100   // 統計情報へのポインタを取得する
+#define DYPT_CMD_SET_IPADDR 0x101   // ARP/ICMP echo の応答に使う IP アドレスを設定する (NULL で解除)
+#define DYPT_CMD_FAULT      0x102   // 故障注入を設定して (NULL なら設定せずに) 状態へのポインタを取得する
+#define DYPT_CMD_GET_LATENCY 0x103  // 遅延ヒストグラムへのポインタを取得する
+
+// 遅延ヒストグラム (50us単位の時間 t を bucket[0]:t=0, bucket[n]:2^(n-1)<=t<2^n に数える)
+#define DYPT_HIST_BUCKETS   16
+
+struct dypt_hist {
+  uint32_t bucket[DYPT_HIST_BUCKETS];
+};
+
+// 送信クラス
+#define DYPT_TX_PRIO        0   // ARP と ICMP、ペイロードのない TCP セグメント (ACK と SYN)
+#define DYPT_TX_BULK        1   // それ以外
+#define DYPT_TX_CLASSES     2
+
+// 処理段階ごとの遅延 (DYPT_CMD_GET_LATENCY で取得、ツール側でゼロクリアしてよい)
+struct dypt_latency {
+  struct dypt_hist rx_poll_wait;  // 受信: 前回のポーリングからの待ち時間
+  struct dypt_hist rx_xfer;       // 受信: SCSI 転送時間
+  struct dypt_hist rx_handler;    // 受信: プロトコルハンドラの処理時間
+  struct dypt_hist tx_queue_wait[DYPT_TX_CLASSES]; // 送信: 送信キューで待った時間 (クラスごと)
+  struct dypt_hist tx_xfer;       // 送信: SCSI 転送時間
+};
+
+// 統計情報 (DYPT_CMD_GET_STATS で取得)
+struct dypt_stats {
+  uint32_t errors;          // 通信エラーの発生回数
+  int32_t last_error;       // 直近の通信エラーの種別 (dp_status_t)
+  uint32_t recoveries;      // エラー回復に成功した回数
+  uint32_t recovery_fails;  // エラー回復の試行に失敗した回数
+  uint32_t recovery_last;   // 直近のエラー回復に要した時間 (10ms単位)
+  uint32_t recovery_total;  // エラー回復に要した時間の合計 (10ms単位)
+  uint32_t irq_masked_max;  // 受信ポーリングで割り込みを禁止した最大時間 (50us単位)
+  uint32_t recv_xfer_max;   // 受信の SCSI 転送に要した最大時間 (50us単位)
+  uint32_t rx_frames;       // 受信したフレーム数
+  uint32_t tx_frames;       // 送信したフレーム数
+  uint32_t rx_delivered;    // プロトコルスタックに渡したフレーム数
+  uint32_t rx_offloaded_arp;  // ドライバ内で応答した ARP 要求の数
+  uint32_t rx_offloaded_icmp; // ドライバ内で応答した ICMP echo 要求の数
+  uint32_t tx_offloaded;    // ドライバ内で送信した応答フレーム数
+  uint32_t rx_oversize;     // 受信ウィンドウを超える長さのため破棄したフレーム数
+  uint32_t rx_unhandled;    // 受信したがプロトコルが登録されていなかったフレーム数
+  uint32_t poll_deferred;   // SCSI バスが使用中のためポーリングを見送った回数 (ネットワーク側の待ち)
+                            // (割り込みの入り口で見送った回数は en0 にだけ数える)
+  uint32_t poll_retried;    // 見送ったポーリングを再試行した回数
+  uint32_t budget_exhausted; // 割り当て時間を使い切って受信を打ち切った回数
+  uint32_t link_up;         // リンク状態 (1:接続 0:切断)
+  uint32_t link_flaps;      // リンクが切断された回数
+  int32_t link_rssi;        // 直近に取得した Wi-Fi の RSSI (dBm)
+  uint32_t tx_linkdown;     // リンク切断中のため送信しなかったフレーム数
+  uint32_t bus_hold_time;   // 受信で SCSI バスを占有した時間の合計 (50us単位) (ディスク側の待ち)
+  uint32_t tx_queue_full;   // 送信キューが一杯のため送信しなかったフレーム数
+  uint32_t tx_prio_frames;  // 優先クラスで送信したフレーム数
+  uint32_t tx_bulk_forced;  // 優先クラスが続いたため通常クラスを先に送信した回数
+};
+
 
 #endif /* _DYPTETHER_H_ */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * dypbench をホストのシミュレータ上で動かすためのドライバ側
+ * dypbench.c の find_ether()/driver_call() の代わりに、同じプログラムに組み込んだドライバを
+ * 直接呼び出す。ポーリングは Timer-C の割り込みを dp_timestamp() の中で模して行い、
+ * シミュレータの DaynaPORT が送信した計測フレームは、反射側の代わりにその場で折り返して
+ * 受信キューに入れる
+ */
+
+#include "drvhost.c"
+
+/* 計測フレーム (dypbench.c の struct dypb_frame) のうち反射で書き換える部分 */
+#define DYPB_ETHERTYPE      0x88b5
+#define DYPB_KIND_OFFSET    (ETH_HLEN + 4)
+#define DYPB_STREAM         1
+#define DYPB_STREAM_ECHO    2
+#define DYPB_REQUEST        3
+#define DYPB_RESPONSE       4
+
+static const uint8_t local_mac[6] = {0x02, 0x00, 0x00, 0x12, 0x34, 0x56};
+static const uint8_t peer_mac[6] = {0x02, 0x00, 0x00, 0x12, 0x34, 0x57};
+
+/* 反射側の代わり: 送信された計測フレームの宛先と送信元を入れ替え、種類を応答にして受信キューに入れる */
+static void reflect(int32_t target, const uint8_t *frame, int32_t len)
+{
+    static uint8_t f[DPSIM_FRAME_MAX];
+
+    if (len < DYPB_KIND_OFFSET + 2 || RD16(frame + 12) != DYPB_ETHERTYPE) return;
+    memcpy(f, frame, len);
+    memcpy(f, frame + 6, 6);
+    memcpy(f + 6, peer_mac, 6);
+    switch (RD16(f + DYPB_KIND_OFFSET))
+    {
+    case DYPB_STREAM:
+        RD16(f + DYPB_KIND_OFFSET) = DYPB_STREAM_ECHO;
+        break;
+    case DYPB_REQUEST:
+        RD16(f + DYPB_KIND_OFFSET) = DYPB_RESPONSE;
+        break;
+    default:
+        return;
+    }
+    dpsim_deliver(target, f, len);     /* 受信キューが一杯なら DaynaPORT で失われる */
+}
+
+/* /dev/en0 の代わりにシミュレータ上のドライバを組み込む (en1 はない) */
+void *host_find_ether(int unit)
+{
+    static bool ready;
+
+    if (unit != 0) return NULL;
+    if (!ready)
+    {
+        if (drvhost_setup(local_mac, reflect) < 0) return NULL;
+        host_interrupt = drvhost_interrupt;
+        host_interrupt_period = DRVHOST_TICK;
+        ready = true;
+    }
+    return &regp->ifs[0];
+}
+
+int host_ether_call(int unit, int cmd, void *args)
+{
+    int res = etherfunc(unit, cmd, args);
+
+    /* MAC アドレスの取得はバッファのアドレスを返すが、64bit のホストでは int に収まらない */
+    if ((cmd == 1 || cmd == 2) && res != -1) return 0;
+    return res;
+}
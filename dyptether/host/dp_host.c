@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ホスト用のプラットフォーム依存部
+ * 時間は host_now を進めて模し、トランスポートはシミュレータ (dpsim.c) を使う
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "daynaport.h"
+#include "dpsim.h"
+
+#define HOST_IRQ_LEVEL  6           /* 割り込みのレベル (MFP) */
+
+uint16_t dp_host_sr = 0x2000;
+uint32_t host_now;
+bool host_in_iocs;
+void (*host_interrupt)(void);
+uint32_t host_interrupt_period;
+
+static uint32_t irq_next;
+static bool irq_pending;
+
+const struct dp_transport *dp_transport = &dpsim_transport;
+
+void dp_set_transport(const struct dp_transport *transport)
+{
+    dp_transport = transport ? transport : &dpsim_transport;
+}
+
+/*
+ * 周期が来ていれば割り込みを起こす (割り込みマスクが割り込みのレベル以上なら保留する)
+ * 割り込みの処理中はマスクを割り込みのレベルに上げるので、処理中に入れ子にはならない
+ */
+static void host_check_interrupt(void)
+{
+    if (host_interrupt == NULL) return;
+    if ((int32_t)(host_now - irq_next) >= 0)
+    {
+        irq_pending = true;
+        irq_next += host_interrupt_period;
+        if ((int32_t)(host_now - irq_next) >= 0) irq_next = host_now + host_interrupt_period;
+    }
+    if (irq_pending && (dp_host_sr & 0x0700) < (HOST_IRQ_LEVEL << 8))
+    {
+        uint16_t sr = dp_host_sr;
+        irq_pending = false;
+        dp_host_sr = (sr & 0xf8ff) | (HOST_IRQ_LEVEL << 8);
+        host_interrupt();
+        dp_host_sr = sr;
+    }
+}
+
+/*
+ * 待ちループが終わるように、時刻を読むたびに 50us 進める
+ * host_interrupt を設定していれば、時刻を読む時に host_interrupt_period ごとの割り込みを模す
+ */
+uint32_t dp_timestamp(void)
+{
+    uint32_t now = host_now++;
+    host_check_interrupt();
+    return now;
+}
+
+uint32_t dp_ontime(void)
+{
+    return dp_timestamp() / 200;
+}
+
+bool dp_is_in_iocs(void)
+{
+    return host_in_iocs;
+}
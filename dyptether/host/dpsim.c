@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "dpsim.h"
+
+/* 1 回の操作に要する時間 (50us単位) とデータ転送の速さ */
+#define COST_SELECT         2
+#define COST_COMMAND        1
+#define COST_STATUS         1
+#define DMA_BYTES_PER_TICK  64      /* 約 1.3MB/s */
+#define PIO_BYTES_PER_TICK  16
+
+#define RESP_MAX            (DP_RECV_HEADER_SIZE + DPSIM_FRAME_MAX + DPSIM_FCS_LEN)
+
+struct dpsim_dev dpsim_dev[DPSIM_TARGETS];
+struct dpsim_stats dpsim_stats;
+uint8_t dpsim_last_cdb[DP_CDB_MAX];
+int32_t dpsim_bus_phase;
+void (*dpsim_on_send)(int32_t target, const uint8_t *frame, int32_t len);
+
+/* 実行中のコマンドの状態 */
+static int32_t cur_target = -1;
+static uint8_t cur_status;
+static uint8_t resp[RESP_MAX];      /* DATA IN で返すデータ */
+static int32_t resp_len;
+static int32_t resp_pos;
+static int32_t out_len;             /* DATA OUT で受け取る長さ */
+
+static void spend(int32_t bytes, int32_t per_tick)
+{
+    host_now += (bytes + per_tick - 1) / per_tick;
+}
+
+void dpsim_reset(void)
+{
+    memset(dpsim_dev, 0, sizeof(dpsim_dev));
+    memset(&dpsim_stats, 0, sizeof(dpsim_stats));
+    memset(dpsim_last_cdb, 0, sizeof(dpsim_last_cdb));
+    dpsim_bus_phase = 0;
+    dpsim_on_send = NULL;
+    cur_target = -1;
+}
+
+void dpsim_attach(int32_t target, int type, const uint8_t *mac)
+{
+    struct dpsim_dev *dev = &dpsim_dev[target];
+
+    memset(dev, 0, sizeof(*dev));
+    dev->type = type;
+    if (mac) memcpy(dev->mac, mac, 6);
+}
+
+/* ネットワークからフレームが届いたことにする (デバイスの受信が有効な時だけ溜める) */
+bool dpsim_deliver(int32_t target, const uint8_t *frame, int32_t len)
+{
+    struct dpsim_dev *dev = &dpsim_dev[target];
+
+    if (!dev->enabled) return false;
+    if (dev->rxcount == DPSIM_RXQ)
+    {
+        dev->rx_dropped++;
+        return false;
+    }
+
+    int32_t i = (dev->rxhead + dev->rxcount) % DPSIM_RXQ;
+    memcpy(dev->rxq[i], frame, len);
+    dev->rxlen[i] = len;
+    dev->rxcount++;
+    return true;
+}
+
+/* READ (0x08) の応答を作る (ヘッダ + フレーム + FCS) */
+static void make_read_response(struct dpsim_dev *dev)
+{
+    memset(resp, 0, DP_RECV_HEADER_SIZE);
+    resp_len = DP_RECV_HEADER_SIZE;
+    if (!dev->enabled || dev->rxcount == 0) return;
+
+    int32_t len = dev->rxlen[dev->rxhead] + DPSIM_FCS_LEN;
+    resp[0] = len >> 8;
+    resp[1] = len;
+    memcpy(&resp[DP_RECV_HEADER_SIZE], dev->rxq[dev->rxhead], len - DPSIM_FCS_LEN);
+    memset(&resp[DP_RECV_HEADER_SIZE + len - DPSIM_FCS_LEN], 0, DPSIM_FCS_LEN);
+    resp_len += len;
+    dev->rxhead = (dev->rxhead + 1) % DPSIM_RXQ;
+    dev->rxcount--;
+    if (dev->rxcount > 0) resp[5] = DP_RECV_FLAG_MORE;
+}
+
+static int32_t sim_select(int32_t target)
+{
+    host_now += COST_SELECT;
+    dpsim_stats.selects++;
+    if (target < 0 || target >= DPSIM_TARGETS || dpsim_dev[target].type == DPSIM_NONE)
+    {
+        cur_target = -1;
+        return -1;
+    }
+    cur_target = target;
+    return 0;
+}
+
+static int32_t sim_cmdout(int32_t size, const uint8_t *cmd)
+{
+    struct dpsim_dev *dev;
+    int32_t alloc = (cmd[3] << 8) | cmd[4];
+
+    host_now += COST_COMMAND;
+    if (cur_target < 0) return -1;
+    dev = &dpsim_dev[cur_target];
+    memcpy(dpsim_last_cdb, cmd, size);
+
+    cur_status = 0;
+    resp_len = resp_pos = 0;
+    out_len = 0;
+    if (dev->type != DPSIM_DAYNAPORT)
+    {
+        cur_status = 2;     /* CHECK CONDITION */
+        return 0;
+    }
+
+    switch (cmd[0])
+    {
+    case 0x08:              /* READ */
+        make_read_response(dev);
+        if (resp_len > alloc) resp_len = alloc;
+        break;
+    case 0x09:              /* RETRIEVE STATISTICS */
+        memset(resp, 0, sizeof(struct dp_stat_data));
+        memcpy(resp, dev->mac, 6);
+        resp_len = sizeof(struct dp_stat_data);
+        if (resp_len > alloc) resp_len = alloc;
+        break;
+    case 0x0a:              /* WRITE */
+        out_len = alloc;
+        break;
+    case 0x0e:              /* ENABLE */
+        dev->enabled = (cmd[5] & 0x80) != 0;
+        break;
+    case 0x1c:              /* BlueSCSI Wi-Fi (サブコマンドは cdb[1] の下位5ビット) */
+        if (dev->wifi && (cmd[1] & 0x1f) == 0x04)
+        {
+            struct dp_wifi_info info;
+            memset(&info, 0, sizeof(info));
+            info.size = sizeof(info);
+            info.rssi = dev->rssi;
+            memcpy(resp, &info, sizeof(info));
+            resp_len = sizeof(info);
+            if (resp_len > alloc) resp_len = alloc;
+        }
+        else
+        {
+            cur_status = 2;
+        }
+        break;
+    default:
+        cur_status = 2;
+        break;
+    }
+    return 0;
+}
+
+/* デバイスが返すデータが要求より短ければ、そこで転送を打ち切る */
+static int32_t datain_common(int32_t size, void *buffer)
+{
+    int32_t n = resp_len - resp_pos;
+
+    if (cur_target < 0) return -1;
+    if (n > size) n = size;
+    memcpy(buffer, &resp[resp_pos], n);
+    resp_pos += n;
+    return 0;
+}
+
+static int32_t sim_datain(int32_t size, void *buffer)
+{
+    dpsim_stats.datain_dma++;
+    spend(size, DMA_BYTES_PER_TICK);
+    return datain_common(size, buffer);
+}
+
+static int32_t sim_datain_pio(int32_t size, void *buffer)
+{
+    dpsim_stats.datain_pio++;
+    spend(size, PIO_BYTES_PER_TICK);
+    return datain_common(size, buffer);
+}
+
+static int32_t sim_dataout(int32_t size, const void *buffer)
+{
+    dpsim_stats.dataout++;
+    spend(size, DMA_BYTES_PER_TICK);
+    if (cur_target < 0 || size != out_len) return -1;
+    if (dpsim_on_send) dpsim_on_send(cur_target, buffer, size);
+    return 0;
+}
+
+static int32_t sim_stsin(uint8_t *sts)
+{
+    host_now += COST_STATUS;
+    if (cur_target < 0) return -1;
+    *sts = cur_status;
+    return 0;
+}
+
+static int32_t sim_msgin(uint8_t *msg)
+{
+    if (cur_target < 0) return -1;
+    *msg = 0;
+    cur_target = -1;
+    return 0;
+}
+
+static int32_t sim_inquiry(int32_t size, int32_t target, void *buffer)
+{
+    struct dp_inquiry_data data;
+
+    host_now += COST_SELECT + COST_COMMAND + COST_STATUS;
+    if (target < 0 || target >= DPSIM_TARGETS || dpsim_dev[target].type == DPSIM_NONE) return -1;
+
+    memset(&data, 0, sizeof(data));
+    data.size = 0x1f;
+    if (dpsim_dev[target].type == DPSIM_DAYNAPORT)
+    {
+        data.unit = 0x03;
+        data.ver = 0x01;
+        memcpy(data.vendor, "Dayna   ", 8);
+        memcpy(data.product, "SCSI/Link       ", 16);
+    }
+    else
+    {
+        data.unit = 0x00;
+        data.ver = 0x02;
+        memcpy(data.vendor, "SIMDISK ", 8);
+        memcpy(data.product, "HOST SIM DISK   ", 16);
+    }
+    memcpy(buffer, &data, size < (int32_t)sizeof(data) ? size : (int32_t)sizeof(data));
+    return 0;
+}
+
+static int32_t sim_phase(void)
+{
+    return dpsim_bus_phase;
+}
+
+const struct dp_transport dpsim_transport =
+{
+    .select = sim_select,
+    .cmdout = sim_cmdout,
+    .datain = sim_datain,
+    .datain_pio = sim_datain_pio,
+    .dataout = sim_dataout,
+    .stsin = sim_stsin,
+    .msgin = sim_msgin,
+    .inquiry = sim_inquiry,
+    .phase = sim_phase,
+};
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DPSIM_H
+#define DPSIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "daynaport.h"
+
+/*
+ * ホスト上で DaynaPORT デバイスを模すシミュレータ
+ * dp_transport として SCSI の各フェーズを実装し、SCSI ID ごとにデバイスを置ける
+ * 時間は host_now (50us単位) を SCSI の操作ごとに進めて模す
+ */
+
+#define DPSIM_TARGETS       8
+#define DPSIM_RXQ           64      /* デバイス内の受信キューの長さ */
+#define DPSIM_FRAME_MAX     1514
+#define DPSIM_FCS_LEN       4
+
+/* SCSI ID に置くデバイスの種類 */
+enum
+{
+    DPSIM_NONE,             /* 何もない (セレクションに応答しない) */
+    DPSIM_DISK,             /* DaynaPORT 以外の SCSI 機器 */
+    DPSIM_DAYNAPORT,
+};
+
+/* SCSI ID ごとのデバイスの状態 */
+struct dpsim_dev
+{
+    int type;
+    uint8_t mac[6];
+    bool enabled;           /* 受信が有効か (0x0e) */
+    bool wifi;              /* BlueSCSI の Wi-Fi 情報 (0x1c) に応答するか */
+    int8_t rssi;
+
+    /* デバイスに届いて READ を待っているフレーム (FCS を含まない) */
+    uint8_t rxq[DPSIM_RXQ][DPSIM_FRAME_MAX];
+    int rxlen[DPSIM_RXQ];
+    int rxhead;
+    int rxcount;
+    uint32_t rx_dropped;    /* 受信キューが一杯で捨てたフレーム数 */
+};
+
+/* SCSI フェーズごとの呼び出し回数 */
+struct dpsim_stats
+{
+    uint32_t selects;
+    uint32_t datain_dma;
+    uint32_t datain_pio;
+    uint32_t dataout;
+};
+
+extern struct dpsim_dev dpsim_dev[DPSIM_TARGETS];
+extern struct dpsim_stats dpsim_stats;
+extern const struct dp_transport dpsim_transport;
+
+extern uint8_t dpsim_last_cdb[DP_CDB_MAX];  /* 最後に受け取った CDB */
+extern int32_t dpsim_bus_phase;             /* 0 以外ならバスが他の機器に使われている */
+
+/* WRITE (0x0a) で送信されたフレームを受け取る */
+extern void (*dpsim_on_send)(int32_t target, const uint8_t *frame, int32_t len);
+
+/* ホストのプラットフォーム依存部 (dp_host.c) */
+extern uint32_t host_now;                   /* 現在時刻 (50us単位) */
+extern bool host_in_iocs;                   /* dp_is_in_iocs() の値 */
+extern void (*host_interrupt)(void);        /* 周期的な割り込みの処理 (NULL なら起こさない) */
+extern uint32_t host_interrupt_period;      /* 割り込みの周期 (50us単位) */
+
+void dpsim_reset(void);
+void dpsim_attach(int32_t target, int type, const uint8_t *mac);
+bool dpsim_deliver(int32_t target, const uint8_t *frame, int32_t len);
+
+#endif /* DPSIM_H */
@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * DaynaPORT プロトコルライブラリ (daynaport.c) をシミュレータに対して実行するテスト
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "daynaport.h"
+#include "dpsim.h"
+
+#define TARGET      5
+#define WINDOW      (DP_RECV_HEADER_SIZE + 1514 + 4)
+
+static int failures;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } \
+    while (0)
+
+static const uint8_t mac[6] = {0x02, 0x00, 0x00, 0x12, 0x34, 0x56};
+
+static uint8_t sent[4][1514];
+static int32_t sent_len[4];
+static int nsent;
+
+static void on_send(int32_t target, const uint8_t *frame, int32_t len)
+{
+    if (nsent < 4)
+    {
+        memcpy(sent[nsent], frame, len);
+        sent_len[nsent] = len;
+    }
+    nsent++;
+}
+
+static void make_frame(uint8_t *f, int32_t len, uint8_t seed)
+{
+    for (int32_t i = 0; i < len; i++) f[i] = seed + i;
+}
+
+static void setup(void)
+{
+    dpsim_reset();
+    dpsim_attach(TARGET, DPSIM_DAYNAPORT, mac);
+    dpsim_attach(3, DPSIM_DISK, NULL);
+    dpsim_on_send = on_send;
+    memset(&dp_counters, 0, sizeof(dp_counters));
+    nsent = 0;
+}
+
+/* ID 7~0 の走査: 応答しない ID はエラーに数えない */
+static void test_scan(void)
+{
+    struct dp_inquiry_data inq;
+    int found = -1;
+
+    setup();
+    for (int32_t target = 7; target >= 0; target--)
+    {
+        if (dp_inquiry(target, &inq) == DP_OK && dp_is_daynaport(&inq))
+        {
+            CHECK(found < 0);
+            found = target;
+        }
+    }
+    CHECK(found == TARGET);
+    CHECK(dp_counters.errors == 0);
+}
+
+static void test_stat_enable(void)
+{
+    struct dp_stat_data stat;
+
+    setup();
+    CHECK(dp_stat(sizeof(stat), TARGET, &stat) == DP_OK);
+    CHECK(memcmp(stat.mac, mac, 6) == 0);
+    CHECK(dp_enable_nowait(TARGET, true) == DP_OK);
+    CHECK(dpsim_dev[TARGET].enabled);
+    CHECK(dp_stat(sizeof(stat), 3, &stat) == DP_ERR_CHECK);
+    CHECK(dp_stat(sizeof(stat), 2, &stat) == DP_ERR_SELECT);
+    CHECK(dp_counters.errors == 2);
+}
+
+/* 短いフレームはプログラム転送、長いフレームは DMA で、長さの分だけ読む */
+static void test_recv_sized(void)
+{
+    static uint8_t buf[WINDOW];
+    uint8_t f[1514];
+
+    setup();
+    dp_enable_nowait(TARGET, true);
+
+    CHECK(dp_recv_sized(WINDOW, TARGET, buf) == DP_OK);
+    CHECK(dp_recv_length(buf) == 0);
+    CHECK(!dp_recv_more(buf));
+
+    make_frame(f, 60, 1);
+    dpsim_deliver(TARGET, f, 60);
+    make_frame(f, 1000, 2);
+    dpsim_deliver(TARGET, f, 1000);
+
+    dpsim_stats.datain_dma = dpsim_stats.datain_pio = 0;
+    CHECK(dp_recv_sized(WINDOW, TARGET, buf) == DP_OK);
+    CHECK(dp_recv_length(buf) == 64);
+    CHECK(dp_recv_more(buf));
+    make_frame(f, 60, 1);
+    CHECK(memcmp(buf + DP_RECV_HEADER_SIZE, f, 60) == 0);
+    CHECK(dpsim_stats.datain_dma == 0);
+    CHECK(dpsim_stats.datain_pio == 2);
+
+    CHECK(dp_recv_sized(WINDOW, TARGET, buf) == DP_OK);
+    CHECK(dp_recv_length(buf) == 1004);
+    CHECK(!dp_recv_more(buf));
+    make_frame(f, 1000, 2);
+    CHECK(memcmp(buf + DP_RECV_HEADER_SIZE, f, 1000) == 0);
+    CHECK(dpsim_stats.datain_dma == 1);
+
+    CHECK(dp_counters.rx_frames == 2);
+    CHECK(dp_counters.rx_bytes == 64 + 1004);
+}
+
+/* 受信ウィンドウを超えるフレームはウィンドウの分だけ読み、長さはそのまま返す */
+static void test_recv_oversize(void)
+{
+    static uint8_t buf[WINDOW];
+    uint8_t f[1514];
+
+    setup();
+    dp_enable_nowait(TARGET, true);
+    make_frame(f, 1514, 3);
+    dpsim_deliver(TARGET, f, 1514);
+
+    CHECK(dp_recv_sized(600, TARGET, buf) == DP_OK);
+    CHECK(dp_recv_length(buf) == 1518);
+    CHECK(memcmp(buf + DP_RECV_HEADER_SIZE, f, 600 - DP_RECV_HEADER_SIZE) == 0);
+
+    make_frame(f, 100, 4);
+    dpsim_deliver(TARGET, f, 100);
+    CHECK(dp_recv(WINDOW, TARGET, buf) == DP_OK);
+    CHECK(dp_recv_length(buf) == 104);
+    CHECK(memcmp(buf + DP_RECV_HEADER_SIZE, f, 100) == 0);
+}
+
+static void test_recv_batch(void)
+{
+    static uint8_t buf[8][WINDOW];
+    uint8_t f[1514];
+    int32_t count;
+
+    setup();
+    dp_enable_nowait(TARGET, true);
+    for (int i = 0; i < 3; i++)
+    {
+        make_frame(f, 100 + i, i);
+        dpsim_deliver(TARGET, f, 100 + i);
+    }
+
+    CHECK(dp_recv_batch(WINDOW, TARGET, buf, 2, &count) == DP_OK);
+    CHECK(count == 2);
+    CHECK(dp_recv_length(buf[1]) == 101 + 4);
+    CHECK(dp_recv_batch(WINDOW, TARGET, buf, 8, &count) == DP_OK);
+    CHECK(count == 1);
+    CHECK(dp_recv_length(buf[0]) == 102 + 4);
+    CHECK(dp_recv_batch(WINDOW, TARGET, buf, 8, &count) == DP_OK);
+    CHECK(count == 0);
+}
+
+/* 送信と、呼び出し元の CDB を書き換えないこと */
+static void test_send(void)
+{
+    uint8_t f1[1514];
+    uint8_t f2[64];
+    const void *frames[2] = {f1, f2};
+    int32_t sizes[2] = {1514, 64};
+    int32_t count;
+
+    setup();
+    make_frame(f1, 1514, 5);
+    make_frame(f2, 64, 6);
+    CHECK(dp_send(1514, TARGET, f1) == DP_OK);
+    CHECK(dpsim_last_cdb[0] == 0x0a);
+    CHECK(((dpsim_last_cdb[3] << 8) | dpsim_last_cdb[4]) == 1514);
+    CHECK(nsent == 1 && sent_len[0] == 1514 && memcmp(sent[0], f1, 1514) == 0);
+
+    CHECK(dp_send_batch(TARGET, frames, sizes, 2, &count) == DP_OK);
+    CHECK(count == 2);
+    CHECK(nsent == 3 && sent_len[2] == 64 && memcmp(sent[2], f2, 64) == 0);
+    CHECK(dp_counters.tx_frames == 3);
+    CHECK(dp_counters.tx_bytes == 1514 * 2 + 64);
+
+    CHECK(dp_send_batch(2, frames, sizes, 2, &count) == DP_ERR_SELECT);
+    CHECK(count == 0);
+}
+
+/* SCSI バスが使用中なら待たずに戻る */
+static void test_try(void)
+{
+    static uint8_t buf[WINDOW];
+    uint8_t f[64];
+
+    setup();
+    dp_enable_nowait(TARGET, true);
+    make_frame(f, 64, 7);
+
+    dpsim_bus_phase = 1;
+    CHECK(dp_try_recv(WINDOW, TARGET, buf) == DP_ERR_BUSY);
+    CHECK(dp_try_send(64, TARGET, f) == DP_ERR_BUSY);
+    CHECK(nsent == 0);
+    dpsim_bus_phase = 0;
+
+    CHECK(dp_bus_claim());
+    CHECK(dp_try_send(64, TARGET, f) == DP_ERR_BUSY);
+    dp_bus_release();
+
+    CHECK(dp_try_send(64, TARGET, f) == DP_OK);
+    CHECK(nsent == 1);
+    CHECK(!dp_bus_busy);
+    CHECK(dp_host_sr == 0x2000);
+}
+
+/* Wi-Fi 情報のサブコマンドは cdb[1] で渡す */
+static void test_wifi(void)
+{
+    struct dp_wifi_info info;
+
+    setup();
+    CHECK(dp_wifi_info(TARGET, &info) == DP_ERR_CHECK);
+    dpsim_dev[TARGET].wifi = true;
+    dpsim_dev[TARGET].rssi = -42;
+    CHECK(dp_wifi_info(TARGET, &info) == DP_OK);
+    CHECK(dpsim_last_cdb[0] == 0x1c && dpsim_last_cdb[1] == 0x04 && dpsim_last_cdb[2] == 0x00);
+    CHECK(info.rssi == -42);
+}
+
+int main(void)
+{
+    test_scan();
+    test_stat_enable();
+    test_recv_sized();
+    test_recv_oversize();
+    test_recv_batch();
+    test_send();
+    test_try();
+    test_wifi();
+
+    if (failures)
+    {
+        printf("dptest: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("dptest: OK\n");
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ホストのテストでドライバ本体 (dyptether.c) を組み込んで動かす共通部分
+ * soak.c と benchhost.c がこのファイルを取り込む (ドライバの static な関数や変数を使うため)
+ */
+
+#include "../dyptether.c"
+
+#include "dpsim.h"
+
+#define DRVHOST_TARGET      5       /* DaynaPORT を置く SCSI ID */
+#define DRVHOST_TICK        TIMERC_PERIOD   /* 割り込みの周期 (Timer-C、50us単位) */
+
+extern bool host_quiet;
+
+static uint8_t drvhost_mem[2 * 65536];     /* 送受信バッファ (常駐部分の後ろの代わり) */
+
+/*
+ * etherinit() と同じ手順で、シミュレータに置いた DaynaPORT を 1 つのインターフェースとして組み込む
+ * (ベクタの設定は除く。割り込みは Timer-C (/i2) でポーリング間隔は /p1 とする)
+ */
+static int drvhost_setup(const uint8_t *mac, void (*on_send)(int32_t, const uint8_t *, int32_t))
+{
+    host_quiet = true;
+    dpsim_reset();
+    dpsim_attach(DRVHOST_TARGET, DPSIM_DAYNAPORT, mac);
+    dpsim_on_send = on_send;
+    init_ifdata();
+    regp->ifs[0].target = DRVHOST_TARGET;
+    regp->nif = 1;
+    regp->irqtype = IRQ_TIMERC;
+    memlimit = drvhost_mem + sizeof(drvhost_mem);
+    if (alloc_buffers(drvhost_mem) < 0 || init_iface(&regp->ifs[0]) < 0)
+    {
+        return -1;
+    }
+    poll_dispatch = inthandler_single;
+    call_handler = call_handler_irq;
+    irq_count_ini = 1;
+    irq_count = irq_count_ini;
+    return 0;
+}
+
+/* head.S の POLL_CHECK と POLL_CALL を模した割り込みの入り口 */
+static void drvhost_interrupt(void)
+{
+    if (--irq_count != 0)
+    {
+        if (!poll_retry) return;
+    }
+    else
+    {
+        irq_count = irq_count_ini;
+    }
+    if (!poll_active) return;
+    if (dp_bus_busy || dp_is_in_iocs())
+    {
+        poll_retry = true;
+        poll_deferred_fast++;
+        return;
+    }
+    poll_dispatch();
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * soak テストと dypbench のホスト版で dyptether.c をリンクするための Human68k/IOCS と head.S の代わり
+ * 時刻は dp_host.c の host_now から作り、画面出力は標準出力に出す
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <x68k/iocs.h>
+#include <x68k/dos.h>
+
+#include "dpsim.h"
+#include "dyptether.h"
+
+/* head.S のシンボル (デバイスヘッダとベクタは使わない) */
+struct dos_dev_header devheader;
+struct dos_dev_header devheader1;
+struct dos_dev_header *const devheader_table[2] = { &devheader, &devheader1 };
+void *const trap_entry_table[2];
+void inthandler_gpio4_asm(void) {}
+void inthandler_timer_a_asm(void) {}
+void inthandler_timer_c_asm(void) {}
+
+bool host_quiet;            /* ドライバのメッセージを表示しない */
+
+struct iocs_time _iocs_ontime(void)
+{
+    uint32_t t = dp_ontime();
+    struct iocs_time tm = { t % (24 * 60 * 60 * 100), t / (24 * 60 * 60 * 100) };
+    return tm;
+}
+
+void *_iocs_b_intvcs(int vector, void *addr) { return NULL; }
+int _iocs_b_super(int stack) { return 0; }
+int _iocs_b_keysns(void) { return 0; }        /* キーは押されない */
+int _iocs_b_keyinp(void) { return 0; }
+int _iocs_osns232c(void) { return 1; }
+void _iocs_out232c(int c) {}
+int _iocs_vdispst(void *addr, int field, int count) { return 0; }
+
+int _iocs_b_print(const char *str)
+{
+    if (!host_quiet) fputs(str, stdout);
+    return 0;
+}
+
+int vsiprintf(char *buf, const char *fmt, va_list ap)
+{
+    return vsprintf(buf, fmt, ap);
+}
+
+void *_dos_intvcg(int vector) { return NULL; }
+void *_dos_intvcs(int vector, void *addr) { return NULL; }
+void _dos_exit(void) { exit(0); }
+void _dos_exit2(int code) { exit(code); }
+int _dos_mfree(void *ptr) { return 0; }
+void _dos_keeppr(int size, int code) { exit(code); }
+int _dos_open_pr(const char *name, int counter, int usp, int ssp, int sr, int pc,
+                 struct dos_prcctrl *buff, long sleep_time) { return -1; }
+int _dos_kill_pr(void) { return 0; }
+long _dos_sleep_pr(long time) { return 0; }
+void _dos_change_pr(void) {}
+int _dos_breakck(int mode) { return 0; }
+
+void _dos_print(const char *str)
+{
+    if (!host_quiet) fputs(str, stdout);
+}
+
+void _dos_putchar(int c)
+{
+    if (!host_quiet) putchar(c);
+}
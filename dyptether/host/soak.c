@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ドライバ本体 (dyptether.c) をシミュレータに対して長時間動かす soak テスト
+ * 割り込みの入り口 (head.S の POLL_CHECK) を模してポーリングし、etherfunc で送信して
+ * 乱数の種から決まる順序で受信、送信、SCSI バスの使用中、故障注入を起こす
+ * 受信したフレームと送信されたフレームを連番と内容で照合し、欠落、重複、破損、順序の
+ * 入れ替わりを数える
+ */
+
+#include "drvhost.c"
+
+#include <getopt.h>
+
+#define TARGET          DRVHOST_TARGET
+#define PROTO_SOAK      0x88b5      /* 試験用のフレームの EtherType (ローカルの実験用) */
+#define TICK            DRVHOST_TICK    /* 割り込みの周期 (50us単位) */
+#define DRAIN_TICKS     10000       /* 最後に溜まったフレームを受信し終えるまで待つ回数 */
+#define SEQ_OFFSET      (ETH_HLEN)  /* 連番を置く位置 */
+#define FRAME_MIN       ETH_ZLEN
+#define FRAME_MAX       (ETH_HLEN + MTU_MAX)
+
+static const uint8_t mac[6] = {0x02, 0x00, 0x00, 0x12, 0x34, 0x56};
+
+/* 方向ごとの照合の状態 */
+struct flow
+{
+    const char *name;
+    uint16_t proto;         /* EtherType */
+    int maxlen;             /* フレーム長の最大 */
+    uint32_t limit;         /* 送り出すフレーム数 */
+    uint32_t next;          /* 次に送り出すフレームの連番 */
+    uint32_t sent;          /* 送り出したフレーム数 (デバイスやドライバが受け付けた分) */
+    uint32_t refused;       /* デバイスやドライバが受け付けなかったフレーム数 */
+    uint32_t received;      /* 受け取った正しいフレーム数 (重複を除く) */
+    uint32_t duplicated;
+    uint32_t corrupted;
+    uint32_t reordered;
+    uint64_t bytes;         /* 受け取った正しいフレームのバイト数 */
+    int64_t last;           /* 最後に受け取った連番 */
+    uint8_t *seen;          /* 受け取った連番のビットマップ */
+};
+
+/* 受信、送信 (通常クラス)、送信 (優先クラスになる小さい ARP) */
+static struct flow rx = { .name = "rx", .proto = PROTO_SOAK, .maxlen = FRAME_MAX, .last = -1 };
+static struct flow tx = { .name = "tx", .proto = PROTO_SOAK, .maxlen = FRAME_MAX, .last = -1 };
+static struct flow ctl = { .name = "ctl", .proto = ETH_TYPE_ARP, .maxlen = TX_PRIO_LEN, .last = -1 };
+
+static uint32_t rand_state;
+
+static uint32_t rand_next(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+/* 連番から決まるフレーム長と内容 */
+static uint32_t hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static int frame_len(const struct flow *fl, uint32_t seq)
+{
+    return FRAME_MIN + hash(seq ^ fl->proto) % (fl->maxlen - FRAME_MIN + 1);
+}
+
+static void make_frame(const struct flow *fl, uint8_t *f, uint32_t seq)
+{
+    int len = frame_len(fl, seq);
+    uint32_t h = hash(seq ^ 0x5a5a5a5a);
+
+    memcpy(f, mac, 6);
+    memcpy(f + 6, mac, 6);
+    f[11] ^= 0x01;
+    f[12] = fl->proto >> 8;
+    f[13] = fl->proto & 0xff;
+    f[SEQ_OFFSET + 0] = seq >> 24;
+    f[SEQ_OFFSET + 1] = seq >> 16;
+    f[SEQ_OFFSET + 2] = seq >> 8;
+    f[SEQ_OFFSET + 3] = seq;
+    for (int i = SEQ_OFFSET + 4; i < len; i++)
+    {
+        f[i] = h >> ((i & 3) * 8) ^ i;
+    }
+}
+
+/* 受け取ったフレームを連番と内容で照合する */
+static void check_frame(struct flow *fl, const uint8_t *f, int len)
+{
+    static uint8_t expect[FRAME_MAX];
+
+    if (len < SEQ_OFFSET + 4)
+    {
+        fl->corrupted++;
+        return;
+    }
+    uint32_t seq = ((uint32_t)f[SEQ_OFFSET] << 24) | (f[SEQ_OFFSET + 1] << 16) |
+                   (f[SEQ_OFFSET + 2] << 8) | f[SEQ_OFFSET + 3];
+    if (seq >= fl->limit || len != frame_len(fl, seq))
+    {
+        fl->corrupted++;
+        return;
+    }
+    make_frame(fl, expect, seq);
+    if (memcmp(f, expect, len) != 0)
+    {
+        fl->corrupted++;
+        return;
+    }
+    if (fl->seen[seq / 8] & (1 << (seq % 8)))
+    {
+        fl->duplicated++;
+        return;
+    }
+    fl->seen[seq / 8] |= 1 << (seq % 8);
+    if ((int64_t)seq < fl->last)
+    {
+        fl->reordered++;
+    }
+    else
+    {
+        fl->last = seq;
+    }
+    fl->received++;
+    fl->bytes += len;
+}
+
+/* プロトコルハンドラ (受信したフレームが届く) */
+static void soak_handler(int len, uint8_t *buf, uint32_t flag)
+{
+    check_frame(&rx, buf, len);
+}
+
+/* etherfunc で 1 フレームの送信を要求する (4 つに 1 つは優先クラスのフレームにする) */
+static void submit_tx(void)
+{
+    uint8_t frame[FRAME_MAX];
+    struct flow *fl = (rand_next() % 4 == 0) ? &ctl : &tx;
+
+    if (fl->next >= fl->limit)
+    {
+        fl = (fl == &ctl) ? &tx : &ctl;
+        if (fl->next >= fl->limit) return;
+    }
+    /* 送信中に呼ばれて入れ子になっても同じ連番を使わないよう、先に連番を進める */
+    uint32_t seq = fl->next++;
+    struct
+    {
+        int size;
+        uint8_t *buf;
+    } sendpkt = { frame_len(fl, seq), frame };
+    make_frame(fl, frame, seq);
+    if (etherfunc(0, 4, &sendpkt) == 0)
+    {
+        fl->sent++;
+    }
+    else
+    {
+        fl->refused++;  /* 送信キューが一杯かエラー回復中 */
+    }
+}
+
+/*
+ * デバイスが送信したフレームが届く
+ * 送信中に割り込みから送信を要求されることもあるので、時々ここからも送信を要求する
+ */
+static void soak_on_send(int32_t target, const uint8_t *frame, int32_t len)
+{
+    check_frame((frame[12] << 8 | frame[13]) == ETH_TYPE_ARP ? &ctl : &tx, frame, len);
+    if (rand_next() % 4 == 0)
+    {
+        submit_tx();
+    }
+}
+
+static void usage(void)
+{
+    printf("usage: soak [-n frames] [-s seed] [-r rate] [-b busy] [-l rx] [-t tx]\n"
+           "  -n frames : 受信と送信のフレーム数 (100000、優先クラスの送信はこの 1/4)\n"
+           "  -s seed   : 乱数の種 (1)\n"
+           "  -r rate   : 全種類の故障の発生率 (1/65536単位、0)\n"
+           "  -b busy   : 割り込みごとに SCSI バスが使用中になる確率 (1/1000単位、0)\n"
+           "  -l rx     : 割り込みごとに届く受信フレーム数の最大 (2)\n"
+           "  -t tx     : 割り込みごとに送信するフレーム数の最大 (2)\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t nframes = 100000;
+    uint32_t seed = 1;
+    uint32_t rate = 0;
+    uint32_t busy = 0;
+    uint32_t rx_load = 2;
+    uint32_t tx_load = 2;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:s:r:b:l:t:")) != -1)
+    {
+        switch (c)
+        {
+        case 'n': nframes = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        case 'r': rate = strtoul(optarg, NULL, 0); break;
+        case 'b': busy = strtoul(optarg, NULL, 0); break;
+        case 'l': rx_load = strtoul(optarg, NULL, 0); break;
+        case 't': tx_load = strtoul(optarg, NULL, 0); break;
+        default: usage();
+        }
+    }
+    if (nframes == 0 || rate > 0xffff || busy > 1000) usage();
+    rx.limit = tx.limit = nframes;
+    ctl.limit = nframes / 4;
+    rx.seen = calloc(rx.limit / 8 + 1, 1);
+    tx.seen = calloc(tx.limit / 8 + 1, 1);
+    ctl.seen = calloc(ctl.limit / 8 + 1, 1);
+    rand_state = seed ? seed : 1;
+
+    if (drvhost_setup(mac, soak_on_send) < 0)
+    {
+        printf("soak: ドライバを初期化できません\n");
+        return 1;
+    }
+
+    struct
+    {
+        int proto;
+        void (*handler)(int, uint8_t *, uint32_t);
+    } setint = { PROTO_SOAK, soak_handler };
+    etherfunc(0, 5, &setint);
+
+    struct dp_fault_config fault = { .seed = seed };
+    for (int i = 0; i < DP_FAULT_NUM; i++) fault.rate[i] = rate;
+    dp_fault_setup(&fault);
+
+    /* 割り込みごとにフレームを届けて送信を要求し、時刻を次の割り込みまで進める */
+    struct ifdata *ifp = &regp->ifs[0];
+    uint32_t start = host_now;
+    uint32_t recovery_max = 0;
+    uint32_t recoveries = 0;
+    static uint8_t frame[FRAME_MAX];
+    uint32_t drain = 0;
+
+    while (drain < DRAIN_TICKS)
+    {
+        uint32_t tick_end = host_now + TICK;
+        bool busy_now = (rand_next() % 1000) < busy;
+
+        host_in_iocs = busy_now;
+        dpsim_bus_phase = busy_now;
+
+        uint32_t n = rand_next() % (rx_load + 1);
+        for (uint32_t i = 0; i < n && rx.next < rx.limit; i++)
+        {
+            uint32_t seq = rx.next++;
+            make_frame(&rx, frame, seq);
+            if (dpsim_deliver(TARGET, frame, frame_len(&rx, seq)))
+            {
+                rx.sent++;
+            }
+            else
+            {
+                rx.refused++;   /* デバイスの受信キューが一杯か受信停止中 */
+            }
+        }
+
+        n = rand_next() % (tx_load + 1);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            submit_tx();
+        }
+
+        drvhost_interrupt();
+
+        host_in_iocs = false;
+        dpsim_bus_phase = 0;
+
+        if (ifp->stats.recoveries != recoveries)
+        {
+            recoveries = ifp->stats.recoveries;
+            update_max(&recovery_max, ifp->stats.recovery_last);
+        }
+        if ((int32_t)(host_now - tick_end) < 0)
+        {
+            host_now = tick_end;
+        }
+        if (rx.next >= rx.limit && tx.next >= tx.limit && ctl.next >= ctl.limit)
+        {
+            /* 全て送り出したら、デバイスとドライバに残ったフレームがなくなるまで回す */
+            if (dpsim_dev[TARGET].rxcount == 0 && !tx_pending(ifp) &&
+                ifp->recovery == RECOVERY_NONE)
+            {
+                break;
+            }
+            drain++;
+        }
+    }
+
+    double secs = (double)(uint32_t)(host_now - start) / 20000;
+    struct flow *const flows[] = { &rx, &tx, &ctl };
+    uint32_t lost = 0, dup = 0, corrupt = 0, reorder = 0;
+
+    printf("soak: seed %u, %u frames, fault rate %u/65536, busy %u/1000, %.1f s\n",
+           seed, nframes, rate, busy, secs);
+    for (int i = 0; i < 3; i++)
+    {
+        struct flow *fl = flows[i];
+        lost += fl->sent - fl->received;
+        dup += fl->duplicated;
+        corrupt += fl->corrupted;
+        reorder += fl->reordered;
+        printf("  %s: sent %u refused %u received %u lost %u dup %u corrupt %u reorder %u"
+               " goodput %.0f B/s\n",
+               fl->name, fl->sent, fl->refused, fl->received, fl->sent - fl->received,
+               fl->duplicated, fl->corrupted, fl->reordered, fl->bytes / secs);
+    }
+    printf("  injected: select %u data %u status %u oversize %u\n",
+           dp_fault.injected[DP_FAULT_SELECT], dp_fault.injected[DP_FAULT_DATA],
+           dp_fault.injected[DP_FAULT_STATUS], dp_fault.injected[DP_FAULT_OVERSIZE]);
+    printf("  errors %u recoveries %u (avg %u max %u x10ms) recovery_fails %u"
+           " rx_oversize %u tx_queue_full %u poll_deferred %u\n",
+           ifp->stats.errors, ifp->stats.recoveries,
+           ifp->stats.recoveries ? ifp->stats.recovery_total / ifp->stats.recoveries : 0,
+           recovery_max, ifp->stats.recovery_fails, ifp->stats.rx_oversize,
+           ifp->stats.tx_queue_full, ifp->stats.poll_deferred);
+
+    /* 重複、破損、順序の入れ替わりは常に、欠落は故障を注入しない時だけ失敗にする */
+    if (dup || corrupt || reorder || (rate == 0 && lost) || drain >= DRAIN_TICKS)
+    {
+        printf("soak: FAILED\n");
+        return 1;
+    }
+    printf("soak: OK\n");
+    return 0;
+}
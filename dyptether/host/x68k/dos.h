@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ホストで dyptether.c をビルドするための DOS コールの宣言 (soak テストと dypbench 用)
+ * 実装は human68k.c にあり、プロセス管理やベクタの操作は何もしない
+ */
+
+#ifndef HOST_X68K_DOS_H
+#define HOST_X68K_DOS_H
+
+struct dos_prcctrl
+{
+    long buf_size;
+    char *buf;
+    unsigned short command;
+    unsigned short your_id;
+};
+
+void *_dos_intvcg(int vector);
+void *_dos_intvcs(int vector, void *addr);
+void _dos_print(const char *str);
+void _dos_putchar(int c);
+void _dos_exit(void);
+void _dos_exit2(int code);
+int _dos_mfree(void *ptr);
+void _dos_keeppr(int size, int code);
+int _dos_open_pr(const char *name, int counter, int usp, int ssp, int sr, int pc,
+                 struct dos_prcctrl *buff, long sleep_time);
+int _dos_kill_pr(void);
+long _dos_sleep_pr(long time);
+void _dos_change_pr(void);
+int _dos_breakck(int mode);
+
+#endif /* HOST_X68K_DOS_H */
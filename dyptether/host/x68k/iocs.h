@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2025 Hirokuni Yano (@hyano)
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * ホストで dyptether.c をビルドするための IOCS コールの宣言 (soak テストと dypbench 用)
+ * 実装は human68k.c にあり、ハードウェアには触れない
+ */
+
+#ifndef HOST_X68K_IOCS_H
+#define HOST_X68K_IOCS_H
+
+#include <stdarg.h>
+
+struct iocs_time
+{
+    int sec;                /* 0 時からの経過時間 (10ms単位) */
+    int day;
+};
+
+struct iocs_time _iocs_ontime(void);
+void *_iocs_b_intvcs(int vector, void *addr);
+int _iocs_b_print(const char *str);
+int _iocs_b_super(int stack);
+int _iocs_b_keysns(void);
+int _iocs_b_keyinp(void);
+int _iocs_osns232c(void);
+void _iocs_out232c(int c);
+int _iocs_vdispst(void *addr, int field, int count);
+int vsiprintf(char *buf, const char *fmt, va_list ap);
+
+#endif /* HOST_X68K_IOCS_H */